@@ -22,11 +22,44 @@ int main (int argc, char* argv[]) {
 	argparser.context_smoothing_exponent());
     wordrep.set_singular_value_exponent(argparser.singular_value_exponent());
     wordrep.set_verbose(argparser.verbose());
+    wordrep.set_num_threads(argparser.num_threads());
+    wordrep.set_single_pass(argparser.single_pass());
+    wordrep.set_memory_limit(argparser.memory_limit());
+    wordrep.set_sketch_memory(argparser.sketch_memory());
+    wordrep.set_subsample_threshold(argparser.subsample_threshold());
+    wordrep.set_subsample_seed(argparser.subsample_seed());
+    wordrep.set_head_size(argparser.head_size());
+    wordrep.set_sort_counts(argparser.sort_counts());
+    wordrep.set_cache_tokens(argparser.cache_tokens());
+    wordrep.set_configurations(argparser.configurations());
 
-    // If given a corpus, extract statistics from it.
-    if (!argparser.corpus_path().empty()) {
+    // Derive statistics from cached counts (of a larger list window or a
+    // smaller rare cutoff) or from count shards, or if given a corpus, extract
+    // statistics from it (or only its word counts or a shard of its counts).
+    if (argparser.derive_from() > 0) {
+	wordrep.DeriveCounts(argparser.derive_from());
+    } else if (argparser.rebucket_from() >= 0) {
+	wordrep.RebucketCounts(argparser.rebucket_from());
+    } else if (!argparser.merge_shards().empty()) {
+	StringManipulator string_manipulator;
+	vector<string> shard_directories;
+	string_manipulator.Split(argparser.merge_shards(), ",",
+				 &shard_directories);
+	wordrep.MergeCorpusShards(shard_directories);
+    } else if (!argparser.corpus_path().empty()) {
 	if (argparser.from_scratch()) { wordrep.ResetOutputDirectory(); }
-	wordrep.ExtractStatistics(argparser.corpus_path());
+	if (argparser.words_only()) {
+	    wordrep.ExtractWordCounts(argparser.corpus_path());
+	    return 0;
+	} else if (!argparser.count_shard().empty()) {
+	    wordrep.CountCorpusShard(argparser.corpus_path(),
+				     argparser.count_shard());
+	    return 0;
+	} else if (argparser.append()) {
+	    wordrep.AppendCorpus(argparser.corpus_path());
+	} else {
+	    wordrep.ExtractStatistics(argparser.corpus_path());
+	}
     }
 
     // Induce word representations from cached statistics.
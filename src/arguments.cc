@@ -34,6 +34,38 @@ void ArgumentProcessor::ParseArguments(int argc, char* argv[]) {
 	    context_smoothing_exponent_ = stod(argv[++i]);
 	} else if (arg == "--se") {
 	    singular_value_exponent_ = stod(argv[++i]);
+	} else if (arg == "--threads") {
+	    num_threads_ = stol(argv[++i]);
+	} else if (arg == "--onepass") {
+	    single_pass_ = true;
+	} else if (arg == "--memory-limit") {
+	    memory_limit_ = stol(argv[++i]);
+	} else if (arg == "--subsample") {
+	    subsample_threshold_ = stod(argv[++i]);
+	} else if (arg == "--seed") {
+	    subsample_seed_ = stol(argv[++i]);
+	} else if (arg == "--append") {
+	    append_ = true;
+	} else if (arg == "--words-only") {
+	    words_only_ = true;
+	} else if (arg == "--count-shard") {
+	    count_shard_ = argv[++i];
+	} else if (arg == "--merge-shards") {
+	    merge_shards_ = argv[++i];
+	} else if (arg == "--sketch") {
+	    sketch_memory_ = stol(argv[++i]);
+	} else if (arg == "--head") {
+	    head_size_ = stol(argv[++i]);
+	} else if (arg == "--sort-counts") {
+	    sort_counts_ = true;
+	} else if (arg == "--cache-tokens") {
+	    cache_tokens_ = true;
+	} else if (arg == "--configs") {
+	    configurations_ = argv[++i];
+	} else if (arg == "--derive-from") {
+	    derive_from_ = stol(argv[++i]);
+	} else if (arg == "--rebucket-from") {
+	    rebucket_from_ = stol(argv[++i]);
 	} else if (arg == "--quiet" || arg == "-q") {
 	    verbose_ = false;
 	} else if (arg == "--help" || arg == "-h"){
@@ -90,6 +122,66 @@ void ArgumentProcessor::ParseArguments(int argc, char* argv[]) {
 	cout << "--se [" << singular_value_exponent_ << "]:       \t"
 	     << "singular value exponent" << endl;
 
+	cout << "--threads [" << num_threads_ << "]:       \t"
+	     << "number of threads for counting" << endl;
+
+	cout << "--onepass:           \t"
+	     << "count words and co-occurrences in one pass (more memory)"
+	     << endl;
+
+	cout << "--memory-limit [" << memory_limit_ << "]:  \t"
+	     << "megabytes for counts before spilling to disk (0 means no limit)"
+	     << endl;
+
+	cout << "--subsample [" << subsample_threshold_ << "]:    \t"
+	     << "drop words of frequency f > t with probability "
+	     << "1 - (sqrt(f/t) + 1) t/f (0 means none)" << endl;
+
+	cout << "--seed [" << subsample_seed_ << "]:          \t"
+	     << "seed for subsampling" << endl;
+
+	cout << "--append:            \t"
+	     << "add counts of files not yet counted to cached counts" << endl;
+
+	cout << "--words-only:         \t"
+	     << "count only words (shared by shards of the corpus)" << endl;
+
+	cout << "--count-shard [-]:    \t"
+	     << "write counts of the corpus to this directory with the words "
+	     << "of --output" << endl;
+
+	cout << "--merge-shards [-]:   \t"
+	     << "sum counts of these comma-separated shard directories "
+	     << "(no corpus)" << endl;
+
+	cout << "--sketch [" << sketch_memory_ << "]:        \t"
+	     << "megabytes for approximate counts of the heaviest pairs "
+	     << "(0 means exact)" << endl;
+
+	cout << "--head [" << head_size_ << "]:          \t"
+	     << "count pairs of this many most frequent words with bag/list "
+	     << "contexts in a dense block" << endl;
+
+	cout << "--sort-counts:        \t"
+	     << "count co-occurrences by sorting buffered pairs instead of "
+	     << "in hash tables" << endl;
+
+	cout << "--cache-tokens:       \t"
+	     << "cache the corpus as word IDs to speed up later window sizes "
+	     << "and contexts" << endl;
+
+	cout << "--configs [-]:        \t"
+	     << "also count these window:context pairs in the same pass, "
+	     << "e.g., 5:list,11:baglist" << endl;
+
+	cout << "--derive-from [-]:    \t"
+	     << "derive bag/list counts from list counts of this window size "
+	     << "(no corpus)" << endl;
+
+	cout << "--rebucket-from [-]:  \t"
+	     << "derive counts from counts of this smaller rare cutoff "
+	     << "(no corpus)" << endl;
+
 	cout << "--quiet, -q:          \t"
 	     << "do not print messages to stderr" << endl;
 
@@ -61,6 +61,55 @@ public:
     // Returns the flag for printing messages to stderr.
     bool verbose() { return verbose_; }
 
+    // Returns the number of threads for counting.
+    size_t num_threads() { return num_threads_; }
+
+    // Returns the flag for counting words and co-occurrences in a single
+    // pass over the corpus.
+    bool single_pass() { return single_pass_; }
+
+    // Returns the memory limit for co-occurrence counts in megabytes.
+    size_t memory_limit() { return memory_limit_; }
+
+    // Returns the threshold for subsampling frequent words.
+    double subsample_threshold() { return subsample_threshold_; }
+
+    // Returns the seed for subsampling frequent words.
+    size_t subsample_seed() { return subsample_seed_; }
+
+    // Returns the flag for appending the files not yet counted.
+    bool append() { return append_; }
+
+    // Returns the flag for counting only words.
+    bool words_only() { return words_only_; }
+
+    // Returns the directory to write the counts of a corpus shard to.
+    string count_shard() { return count_shard_; }
+
+    // Returns the comma-separated shard directories to merge counts from.
+    string merge_shards() { return merge_shards_; }
+
+    // Returns the memory for approximate co-occurrence counts in megabytes.
+    size_t sketch_memory() { return sketch_memory_; }
+
+    // Returns the number of most frequent words counted in a dense block.
+    size_t head_size() { return head_size_; }
+
+    // Returns the flag for counting co-occurrences by sort and reduce.
+    bool sort_counts() { return sort_counts_; }
+
+    // Returns the flag for caching the corpus as word IDs.
+    bool cache_tokens() { return cache_tokens_; }
+
+    // Returns the additional window configurations to count.
+    string configurations() { return configurations_; }
+
+    // Returns the window size of list counts to derive counts from.
+    size_t derive_from() { return derive_from_; }
+
+    // Returns the smaller rare cutoff of counts to re-bucket counts from.
+    long rebucket_from() { return rebucket_from_; }
+
 private:
     // Path to a corpus.
     string corpus_path_;
@@ -106,6 +155,61 @@ private:
 
     // Print messages to stderr?
     bool verbose_ = true;
+
+    // Number of threads for counting.
+    size_t num_threads_ = 1;
+
+    // Count words and co-occurrences in a single pass?
+    bool single_pass_ = false;
+
+    // Memory limit for co-occurrence counts in megabytes (0 means no limit).
+    size_t memory_limit_ = 0;
+
+    // Memory for approximate co-occurrence counts in megabytes (0 means exact
+    // counts).
+    size_t sketch_memory_ = 0;
+
+    // Threshold for subsampling frequent words (0 means no subsampling).
+    double subsample_threshold_ = 0.0;
+
+    // Seed for subsampling frequent words.
+    size_t subsample_seed_ = 1;
+
+    // Add the statistics of files not yet counted to the cached statistics?
+    bool append_ = false;
+
+    // Count only the words of the corpus (shared by count shards)?
+    bool words_only_ = false;
+
+    // Directory to write the co-occurrence counts of the corpus to, with the
+    // word counts of the output directory (empty means no shard).
+    string count_shard_;
+
+    // Comma-separated shard directories whose counts are summed into the
+    // output directory instead of reading a corpus.
+    string merge_shards_;
+
+    // Number of most frequent words whose pairs with bag or list contexts
+    // are counted in a dense block (0 means none).
+    size_t head_size_ = 0;
+
+    // Count co-occurrences by sort and reduce instead of in hash tables?
+    bool sort_counts_ = false;
+
+    // Cache the corpus as word IDs for later window sliding?
+    bool cache_tokens_ = false;
+
+    // Additional window configurations to count in the same corpus pass,
+    // e.g., "5:list,11:baglist" (window size:context definition).
+    string configurations_;
+
+    // Window size of cached list counts to derive counts from instead of
+    // reading a corpus (0 means no derivation).
+    size_t derive_from_ = 0;
+
+    // Smaller rare cutoff of cached counts to re-bucket counts from instead
+    // of reading a corpus (-1 means no re-bucketing).
+    long rebucket_from_ = -1;
 };
 
 #endif  // ARGUMENTS_H_
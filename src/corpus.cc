@@ -0,0 +1,240 @@
+// Author: Karl Stratos (stratos@cs.columbia.edu)
+
+#include "corpus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string &file_path) {
+    file_descriptor_ = open(file_path.c_str(), O_RDONLY);
+    ASSERT(file_descriptor_ >= 0, "Cannot open file: " << file_path);
+    struct stat stat_buffer;
+    ASSERT(fstat(file_descriptor_, &stat_buffer) == 0,
+	   "Problem with " << file_path);
+    size_ = stat_buffer.st_size;
+    if (size_ > 0) {  // Cannot map an empty file.
+	void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE,
+			 file_descriptor_, 0);
+	ASSERT(map != MAP_FAILED, "Cannot map file: " << file_path);
+	data_ = (const char *) map;
+	madvise(map, size_, MADV_SEQUENTIAL);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) { munmap((void *) data_, size_); }
+    if (file_descriptor_ >= 0) { close(file_descriptor_); }
+}
+
+StreamedFile::StreamedFile(const string &file_path) : file_path_(file_path) {
+    if (file_path == "-") {
+	stream_ = stdin;
+    } else {
+	string quoted_path = "'";
+	for (char c : file_path) {
+	    quoted_path += (c == '\'') ? string("'\\''") : string(1, c);
+	}
+	quoted_path += "'";
+	stream_ = popen((Decompressor(file_path) + " -dc < " +
+			 quoted_path).c_str(), "r");
+	ASSERT(stream_ != nullptr, "Cannot decompress file: " << file_path);
+    }
+    reader_ = thread(&StreamedFile::ReadBlocks, this);
+}
+
+StreamedFile::~StreamedFile() {
+    {
+	lock_guard<mutex> lock(mutex_);
+	stopped_ = true;
+    }
+    changed_.notify_all();
+    reader_.join();
+}
+
+bool StreamedFile::NextBlock(string *block) {
+    unique_lock<mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return !blocks_.empty() || done_; });
+    if (blocks_.empty()) { return false; }
+    block->swap(blocks_.front());
+    blocks_.pop_front();
+    lock.unlock();
+    changed_.notify_all();
+    return true;
+}
+
+bool StreamedFile::IsStream(const string &file_path) {
+    return file_path == "-" || !Decompressor(file_path).empty();
+}
+
+string StreamedFile::Decompressor(const string &file_path) {
+    for (const auto &extension_pair : {make_pair(string(".gz"), "gzip"),
+		make_pair(string(".bz2"), "bzip2"),
+		make_pair(string(".zst"), "zstd")}) {
+	const string &extension = extension_pair.first;
+	if (file_path.size() >= extension.size() &&
+	    file_path.compare(file_path.size() - extension.size(),
+			      extension.size(), extension) == 0) {
+	    return extension_pair.second;
+	}
+    }
+    return "";
+}
+
+void StreamedFile::ReadBlocks() {
+    int descriptor = fileno(stream_);
+    bool stopped = false;
+    bool end = false;
+    while (!stopped && !end) {
+	string block(kBlockSize, '\0');
+	size_t size = 0;
+	while (size < kBlockSize && !stopped && !end) {
+	    // Wait in short polls so that a stop is seen even if no text comes,
+	    // instead of blocking in a read that the destructor cannot end.
+	    struct pollfd poll_descriptor = {descriptor, POLLIN, 0};
+	    if (poll(&poll_descriptor, 1, kPollMilliseconds) <= 0) {
+		lock_guard<mutex> lock(mutex_);
+		stopped = stopped_;
+		continue;
+	    }
+	    ssize_t num_read = read(descriptor, &block[size],
+				    kBlockSize - size);
+	    if (num_read > 0) {
+		size += num_read;
+	    } else if (num_read == 0 || errno != EINTR) {
+		end = true;
+	    }
+	}
+	if (size == 0) { continue; }
+	block.resize(size);
+	unique_lock<mutex> lock(mutex_);
+	changed_.wait(lock, [this]() {
+		return blocks_.size() < kMaxBlocks || stopped_;
+	    });
+	blocks_.push_back(move(block));
+	stopped = stopped_;
+	lock.unlock();
+	changed_.notify_all();
+    }
+    if (stream_ != stdin) {
+	int status = pclose(stream_);
+	ASSERT(stopped || status == 0, "Cannot decompress file: "
+	       << file_path_);
+    }
+    {
+	lock_guard<mutex> lock(mutex_);
+	done_ = true;
+    }
+    changed_.notify_all();
+}
+
+CorpusReader::CorpusReader(const string &file_path) :
+    CorpusReader(file_path, 0, string::npos) { }
+
+CorpusReader::CorpusReader(const string &file_path, size_t begin,
+			   size_t end) {
+    if (StreamedFile::IsStream(file_path)) {
+	ASSERT(begin == 0, "Cannot start in the middle of a stream: "
+	       << file_path);
+	stream_.reset(new StreamedFile(file_path));
+	end_ = string::npos;
+    } else {
+	file_.reset(new MappedFile(file_path));
+	position_ = min(begin, file_->size());
+	end_ = min(end, file_->size());
+    }
+}
+
+bool CorpusReader::NextPiece(size_t max_size, StringPiece *piece,
+			     bool *line_end) {
+    if (stream_ != nullptr) {
+	return NextStreamedPiece(max_size, piece, line_end);
+    }
+    if ((!in_line_ && position_ >= end_) || position_ >= file_->size()) {
+	return false;
+    }
+    size_t size = file_->size() - position_;
+    piece->data = file_->data() + position_;
+    piece->size = PieceLength(piece->data, size, max_size, true, 0,
+			      line_end);
+    position_ += piece->size + ((piece->size < size) ? 1 : 0);
+    in_line_ = !*line_end;
+    return true;
+}
+
+bool CorpusReader::NextStreamedPiece(size_t max_size, StringPiece *piece,
+				     bool *line_end) {
+    size_t size;
+    size_t num_scanned = 0;
+    string block;
+    while ((size = buffer_.size() - buffer_position_) > 0 || !stream_done_) {
+	piece->size = PieceLength(buffer_.data() + buffer_position_, size,
+				  max_size, stream_done_, num_scanned,
+				  line_end);
+	if (piece->size != string::npos) { break; }
+	num_scanned = size;
+
+	// Keep the partial piece and append the next block.
+	if (!stream_->NextBlock(&block)) {
+	    stream_done_ = true;
+	    continue;
+	}
+	buffer_.erase(0, buffer_position_);
+	buffer_position_ = 0;
+	buffer_ += block;
+    }
+    if (size == 0) { return false; }
+    piece->data = buffer_.data() + buffer_position_;
+    size_t length = piece->size + ((piece->size < size) ? 1 : 0);
+    buffer_position_ += length;
+    position_ += length;
+    return true;
+}
+
+size_t CorpusReader::PieceLength(const char *text, size_t size,
+				 size_t max_size, bool complete,
+				 size_t num_scanned, bool *line_end) {
+    // The character after max_size bytes tells if they end with a token.
+    size_t window = (size > max_size) ? max_size + 1 : size;
+    if (num_scanned < window) {
+	const char *newline = (const char *) memchr(text + num_scanned, '\n',
+						    window - num_scanned);
+	if (newline != nullptr) {
+	    *line_end = true;
+	    return newline - text;
+	}
+    }
+    if (size <= max_size) {
+	if (!complete) { return string::npos; }
+	*line_end = true;
+	return size;
+    }
+
+    // Cut at the last space, or else after the token longer than max_size.
+    *line_end = false;
+    if (num_scanned <= max_size) {  // Else already found no space
+	for (size_t length = max_size; length > 0; --length) {
+	    if (text[length] == ' ') { return length; }
+	}
+    }
+    for (size_t length = max(max_size + 1, num_scanned); length < size;
+	 ++length) {
+	if (text[length] == ' ' || text[length] == '\n') {
+	    *line_end = (text[length] == '\n');
+	    return length;
+	}
+    }
+    if (!complete) { return string::npos; }
+    *line_end = true;
+    return size;
+}
+
+TokenIdReader::TokenIdReader(const string &file_path) : file_(file_path) {
+    ASSERT(file_.size() >= sizeof(Header) &&
+	   (file_.size() - sizeof(Header)) % sizeof(uint32_t) == 0,
+	   "Not a token ID file: " << file_path);
+}
@@ -0,0 +1,222 @@
+// Author: Karl Stratos (stratos@cs.columbia.edu)
+//
+// Code for reading text corpora.
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "util.h"
+
+using namespace std;
+
+// Read-only memory map of a whole file.
+class MappedFile {
+public:
+    // Maps the file.
+    MappedFile(const string &file_path);
+
+    // Unmaps and closes the file.
+    ~MappedFile();
+
+    // Returns the start of the map (nullptr for an empty file).
+    const char *data() { return data_; }
+
+    // Returns the size of the file in bytes.
+    size_t size() { return size_; }
+
+private:
+    // File descriptor of the mapped file.
+    int file_descriptor_ = -1;
+
+    // Start of the memory map (nullptr for an empty file).
+    const char *data_ = nullptr;
+
+    // Size of the file in bytes.
+    size_t size_ = 0;
+};
+
+// Text of a compressed file (.gz, .bz2, .zst) or of standard input ("-"),
+// read by a separate thread through a pipe from the decompressor into a
+// bounded queue of blocks. The text is never written to disk.
+class StreamedFile {
+public:
+    // Starts reading the file.
+    StreamedFile(const string &file_path);
+
+    // Stops reading and closes the stream.
+    ~StreamedFile();
+
+    // Moves the next block of text into the given string: returns false at
+    // the end of the text.
+    bool NextBlock(string *block);
+
+    // Returns true if the file must be streamed (compressed or "-").
+    static bool IsStream(const string &file_path);
+
+private:
+    // Returns the command decompressing the file, judging by its extension
+    // (empty if not compressed).
+    static string Decompressor(const string &file_path);
+
+    // Reads blocks into the queue until the end of the text (or until
+    // stopped).
+    void ReadBlocks();
+
+    // Number of bytes in a block.
+    static const size_t kBlockSize = 1 << 20;
+
+    // Milliseconds to wait for text before checking if reading is stopped
+    // (standard input may never send more).
+    static const int kPollMilliseconds = 100;
+
+    // Maximum number of blocks in the queue.
+    static const size_t kMaxBlocks = 8;
+
+    // Path to the file.
+    string file_path_;
+
+    // Stream of the text: a pipe from the decompressor, or standard input.
+    FILE *stream_ = nullptr;
+
+    // Blocks read but not yet taken.
+    deque<string> blocks_;
+
+    // Is the whole text read? Is reading stopped?
+    bool done_ = false;
+    bool stopped_ = false;
+
+    // Guards the queue and the flags above.
+    mutex mutex_;
+    condition_variable changed_;
+
+    // Thread reading the stream.
+    thread reader_;
+};
+
+// Reads lines of a corpus file through a read-only memory map. Lines are
+// handed out as pieces of the map (without the newline), so they are not
+// copied. Only lines starting in the byte range [begin, end) are read. A
+// compressed file or standard input is streamed instead (see StreamedFile):
+// it is read whole, and a line is valid only until the next line is read.
+// Lines can also be read in pieces of bounded size, so that a line of any
+// length is streamed through a bounded buffer.
+class CorpusReader {
+public:
+    // Opens the whole file.
+    CorpusReader(const string &file_path);
+
+    // Opens the lines of the file starting in [begin, end) (a streamed file
+    // cannot start in the middle).
+    CorpusReader(const string &file_path, size_t begin, size_t end);
+
+    // Reads the next line into the given piece: returns false if there is no
+    // more line to read.
+    bool NextLine(StringPiece *line) {
+	bool line_end;
+	return NextPiece(string::npos, line, &line_end);
+    }
+
+    // Reads the next piece of the current line into the given piece: at most
+    // max_size bytes, cut at a space so that tokens are whole (a token longer
+    // than max_size makes a piece of its own). Sets line_end to whether the
+    // piece ends its line. Returns false if there is no more text to read.
+    bool NextPiece(size_t max_size, StringPiece *piece, bool *line_end);
+
+    // Returns the byte offset of the next line (in the decompressed text if
+    // streamed).
+    size_t position() { return position_; }
+
+private:
+    // Reads the next piece of a streamed file.
+    bool NextStreamedPiece(size_t max_size, StringPiece *piece,
+			   bool *line_end);
+
+    // Returns the length of the next piece of the given text (see
+    // NextPiece), or string::npos if more text is needed to tell. The text
+    // is complete if nothing follows it. The first num_scanned bytes are
+    // known not to end the piece (from a call that needed more text), so
+    // they are not scanned again.
+    static size_t PieceLength(const char *text, size_t size, size_t max_size,
+			      bool complete, size_t num_scanned,
+			      bool *line_end);
+
+    // Map of the file (unless streamed).
+    unique_ptr<MappedFile> file_;
+
+    // Streamed text (if streamed), with a buffer of the text from the start
+    // of the next line.
+    unique_ptr<StreamedFile> stream_;
+    string buffer_;
+    size_t buffer_position_ = 0;
+    bool stream_done_ = false;
+
+    // Byte offset of the next line (or piece).
+    size_t position_ = 0;
+
+    // True if the last piece read did not end its line.
+    bool in_line_ = false;
+
+    // Lines starting at or after this byte offset are not read.
+    size_t end_ = 0;
+};
+
+// Corpus tokenized into word IDs, stored as a binary file of 32-bit IDs with
+// markers for the end of sentences (lines) and files, after a header that
+// identifies the vocabulary and the corpus the IDs were made from.
+class TokenIdReader {
+public:
+    // Marks the end of a sentence (line).
+    static const uint32_t kSentenceEnd = UINT32_MAX;
+
+    // Marks the end of a file.
+    static const uint32_t kFileEnd = UINT32_MAX - 1;
+
+    // Marks the end of a sentence (line) too long to be counted as a
+    // sentence, which only counts in whole-text mode.
+    static const uint32_t kLongSentenceEnd = UINT32_MAX - 2;
+
+    // Stands for a word not in the dictionary without rare words, which can
+    // only be in a line too long to be a sentence (if the dictionary was
+    // made with a sentence per line).
+    static const uint32_t kUnknownWord = UINT32_MAX - 3;
+
+    // Version of the format, changed when the same text gives other IDs.
+    static const uint32_t kFormat = 2;
+
+    // Header of a token ID file.
+    struct Header {
+	uint64_t vocabulary_signature;
+	uint64_t corpus_size;  // Bytes
+    };
+
+    // Maps the file (which must have a header).
+    TokenIdReader(const string &file_path);
+
+    // Returns the header.
+    const Header &header() { return *((const Header *) file_.data()); }
+
+    // Returns the IDs (and markers).
+    const uint32_t *ids() {
+	return (const uint32_t *) (file_.data() + sizeof(Header));
+    }
+
+    // Returns the number of IDs (and markers).
+    size_t num_ids() {
+	return (file_.size() - sizeof(Header)) / sizeof(uint32_t);
+    }
+
+private:
+    // Map of the file.
+    MappedFile file_;
+};
+
+#endif  // CORPUS_H
@@ -0,0 +1,403 @@
+// Author: Karl Stratos (stratos@cs.columbia.edu)
+
+#include "counts.h"
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <queue>
+
+uint64_t CooccurrenceCounts::Get(size_t context, size_t word) const {
+    uint64_t key = ((uint64_t) context << 32) | word;
+    if (buffer_size_ > 0) {
+	uint64_t count = std::count(buffer_.begin(), buffer_.end(), key);
+	for (const Record &record : weighted_buffer_) {
+	    if (record.key == key) { count += record.count; }
+	}
+	for (const vector<Record> &block : blocks_) {
+	    auto record = lower_bound(block.begin(), block.end(), key,
+				      [](const Record &record, uint64_t key) {
+					  return record.key < key;
+				      });
+	    if (record != block.end() && record->key == key) {
+		count += record->count;
+	    }
+	}
+	return count;
+    }
+    if (entries_.empty()) { return 0; }
+    const Entry &entry = entries_[Find(key)];
+    return (entry.key != kEmptyKey) ? Total(entry) : 0;
+}
+
+size_t CooccurrenceCounts::size() const {
+    if (buffer_size_ == 0) { return num_pairs_; }
+    size_t num_pairs = buffer_.size() + weighted_buffer_.size();
+    for (const vector<Record> &block : blocks_) { num_pairs += block.size(); }
+    return num_pairs;
+}
+
+SMat CooccurrenceCounts::ToSparseMatrix(size_t num_rows, size_t num_columns,
+					size_t num_threads) {
+    size_t num_nonzeros = Sort(num_threads);
+    SMat sparse_matrix = svdNewSMat(num_rows, num_columns, num_nonzeros);
+    size_t col = 0;
+    size_t i = 0;
+    sparse_matrix->pointr[0] = 0;
+    ForEachSorted([&](uint64_t key, uint64_t count) {
+	    size_t context = key >> 32;
+	    size_t word = key & UINT32_MAX;
+	    ASSERT(context < num_columns && word < num_rows, "Pair ("
+		   << context << ", " << word << ") out of " << num_rows
+		   << " x " << num_columns);
+	    while (col < context) { sparse_matrix->pointr[++col] = i; }
+	    sparse_matrix->rowind[i] = word;
+	    sparse_matrix->value[i++] = count;
+	});
+    while (col < num_columns) { sparse_matrix->pointr[++col] = num_nonzeros; }
+    Clear();
+    return sparse_matrix;
+}
+
+void CooccurrenceCounts::WriteRun(const string &file_path,
+				  size_t num_threads) {
+    Sort(num_threads);
+    ofstream file(file_path, ios::out | ios::binary);
+    ASSERT(file.is_open(), "Cannot open file: " << file_path);
+    vector<Record> block;
+    block.reserve(kRecordsPerBlock);
+    auto write_block = [&]() {
+	file.write((const char *) block.data(), block.size() * sizeof(Record));
+	block.clear();
+    };
+    ForEachSorted([&](uint64_t key, uint64_t count) {
+	    block.push_back({key, count});
+	    if (block.size() == kRecordsPerBlock) { write_block(); }
+	});
+    if (!block.empty()) { write_block(); }
+    ASSERT(file.good(), "Cannot write run file: " << file_path);
+    Clear();
+}
+
+void CooccurrenceCounts::AddRun(const string &file_path,
+				const vector<size_t> &context_map,
+				const vector<size_t> &word_map) {
+    ForEachInRun(file_path, [&](size_t context, size_t word, uint64_t count) {
+	    Add((context_map.empty()) ? context : context_map[context],
+		(word_map.empty()) ? word : word_map[word], count);
+	});
+}
+
+void CooccurrenceCounts::MergeRuns(const vector<string> &run_paths,
+				   size_t num_rows, size_t num_columns,
+				   const string &file_path,
+				   vector<double> *row_sum,
+				   vector<double> *column_sum) {
+    row_sum->assign(num_rows, 0.0);
+    column_sum->assign(num_columns, 0.0);
+
+    // Each run is read a block at a time. The heap holds the next key of
+    // every run that is not exhausted.
+    vector<ifstream> files(run_paths.size());
+    vector<vector<Record> > blocks(run_paths.size());
+    vector<size_t> positions(run_paths.size(), 0);
+    auto fill_block = [&](size_t run) {
+	blocks[run].resize(kRecordsPerBlock);
+	files[run].read((char *) blocks[run].data(),
+			kRecordsPerBlock * sizeof(Record));
+	blocks[run].resize(files[run].gcount() / sizeof(Record));
+	positions[run] = 0;
+	return !blocks[run].empty();
+    };
+    priority_queue<pair<uint64_t, size_t>, vector<pair<uint64_t, size_t> >,
+		   greater<pair<uint64_t, size_t> > > heap;
+    for (size_t run = 0; run < run_paths.size(); ++run) {
+	files[run].open(run_paths[run], ios::in | ios::binary);
+	ASSERT(files[run].is_open(), "Cannot open file: " << run_paths[run]);
+	if (fill_block(run)) { heap.push(make_pair(blocks[run][0].key, run)); }
+    }
+
+    // The number of nonzeros is known only at the end: write the columns to
+    // a temporary file and copy them after the header.
+    string columns_path = file_path + ".columns";
+    ofstream file(columns_path, ios::out);
+    ASSERT(file.is_open(), "Cannot open file: " << columns_path);
+
+    size_t num_nonzeros = 0;
+    size_t col = 0;
+    vector<pair<size_t, uint64_t> > column;  // Rows and counts of column col
+    auto write_column = [&]() {
+	file << column.size() << endl;
+	for (const auto &row_pair : column) {
+	    file << row_pair.first << " " << row_pair.second << endl;
+	    (*row_sum)[row_pair.first] += row_pair.second;
+	    (*column_sum)[col] += row_pair.second;
+	}
+	num_nonzeros += column.size();
+	column.clear();
+	++col;
+    };
+    while (!heap.empty()) {
+	uint64_t key = heap.top().first;
+	uint64_t count = 0;
+	while (!heap.empty() && heap.top().first == key) {
+	    size_t run = heap.top().second;
+	    heap.pop();
+	    count += blocks[run][positions[run]].count;
+	    if (++positions[run] < blocks[run].size() || fill_block(run)) {
+		heap.push(make_pair(blocks[run][positions[run]].key, run));
+	    }
+	}
+	size_t context = key >> 32;
+	size_t word = key & UINT32_MAX;
+	ASSERT(context < num_columns && word < num_rows, "Pair (" << context
+	       << ", " << word << ") out of " << num_rows << " x "
+	       << num_columns);
+	while (col < context) { write_column(); }
+	column.push_back(make_pair(word, count));
+    }
+    while (col < num_columns) { write_column(); }
+    file.close();
+    ASSERT(!file.fail(), "Cannot write file: " << columns_path);
+
+    ofstream matrix_file(file_path, ios::out);
+    ASSERT(matrix_file.is_open(), "Cannot open file: " << file_path);
+    matrix_file << num_rows << " " << num_columns << " " << num_nonzeros
+		<< endl;
+    ifstream columns_file(columns_path, ios::in);
+    if (num_columns > 0) { matrix_file << columns_file.rdbuf(); }
+    ASSERT(matrix_file.good(), "Cannot write file: " << file_path);
+    remove(columns_path.c_str());
+}
+
+size_t CooccurrenceCounts::Sort(size_t num_threads) {
+    if (buffer_size_ > 0) {
+	MergeBlocks();
+	return Sorted().size();
+    }
+    SortInPlace(num_threads);
+    return entries_.size();
+}
+
+void CooccurrenceCounts::SortInPlace(size_t num_threads) {
+    size_t num_pairs = 0;
+    for (const Entry &entry : entries_) {
+	if (entry.key != kEmptyKey) { entries_[num_pairs++] = entry; }
+    }
+    entries_.resize(num_pairs);
+    parallel_sort(entries_.begin(), entries_.end(),
+		  [](const Entry &left, const Entry &right) {
+		      return left.key < right.key;
+		  }, num_threads);
+}
+
+void CooccurrenceCounts::Clear() {
+    vector<Entry>().swap(entries_);
+    num_pairs_ = 0;
+    unordered_map<uint64_t, uint64_t>().swap(overflow_);
+    vector<uint64_t>().swap(buffer_);
+    vector<Record>().swap(weighted_buffer_);
+    vector<uint64_t>().swap(sort_space_);
+    vector<vector<Record> >().swap(blocks_);
+    block_bytes_ = 0;
+}
+
+void CooccurrenceCounts::Reserve(size_t num_pairs) {
+    if (buffer_size_ > 0) { return; }
+    size_t num_slots = NumSlots(num_pairs);
+    if (num_slots > entries_.size()) { Resize(num_slots); }
+}
+
+void CooccurrenceCounts::Resize(size_t num_slots) {
+    vector<Entry> old_entries(num_slots, Entry{kEmptyKey, 0});
+    old_entries.swap(entries_);
+    for (const Entry &entry : old_entries) {
+	if (entry.key != kEmptyKey) { entries_[Find(entry.key)] = entry; }
+    }
+}
+
+void CooccurrenceCounts::ReduceBuffer() {
+    // Least significant digit first, skipping the digits that are the same
+    // in all keys (e.g., the high bits of small IDs).
+    uint64_t all_bits = 0;
+    uint64_t common_bits = UINT64_MAX;
+    for (uint64_t key : buffer_) {
+	all_bits |= key;
+	common_bits &= key;
+    }
+    uint64_t varying_bits = all_bits ^ common_bits;
+    const size_t num_digits = 1 << kRadixBits;
+    vector<size_t> offsets(num_digits);
+    sort_space_.resize(buffer_.size());
+    for (size_t shift = 0; shift < 64; shift += kRadixBits) {
+	if (((varying_bits >> shift) & (num_digits - 1)) == 0) { continue; }
+	fill(offsets.begin(), offsets.end(), 0);
+	for (uint64_t key : buffer_) {
+	    ++offsets[(key >> shift) & (num_digits - 1)];
+	}
+	size_t offset = 0;
+	for (size_t &digit_offset : offsets) {
+	    size_t num_keys = digit_offset;
+	    digit_offset = offset;
+	    offset += num_keys;
+	}
+	for (uint64_t key : buffer_) {
+	    sort_space_[offsets[(key >> shift) & (num_digits - 1)]++] = key;
+	}
+	buffer_.swap(sort_space_);
+    }
+
+    // Reduce runs of equal keys.
+    vector<Record> block;
+    for (size_t i = 0; i < buffer_.size(); ) {
+	size_t j = i + 1;
+	while (j < buffer_.size() && buffer_[j] == buffer_[i]) { ++j; }
+	block.push_back({buffer_[i], j - i});
+	i = j;
+    }
+    buffer_.clear();
+    if (!weighted_buffer_.empty()) {
+	sort(weighted_buffer_.begin(), weighted_buffer_.end(),
+	     [](const Record &left, const Record &right) {
+		 return left.key < right.key;
+	     });
+	size_t num_weighted = 0;
+	for (const Record &record : weighted_buffer_) {
+	    if (num_weighted > 0 &&
+		weighted_buffer_[num_weighted - 1].key == record.key) {
+		weighted_buffer_[num_weighted - 1].count += record.count;
+	    } else {
+		weighted_buffer_[num_weighted++] = record;
+	    }
+	}
+	weighted_buffer_.resize(num_weighted);
+	vector<Record> reduced;
+	MergeTwoBlocks(block, weighted_buffer_, &reduced);
+	block.swap(reduced);
+	weighted_buffer_.clear();
+    }
+    if (block.empty()) { return; }
+    blocks_.push_back(move(block));
+
+    while (blocks_.size() >= 2 &&
+	   blocks_[blocks_.size() - 2].size() <= 2 * blocks_.back().size()) {
+	vector<Record> merged;
+	MergeTwoBlocks(blocks_[blocks_.size() - 2], blocks_.back(), &merged);
+	blocks_.pop_back();
+	blocks_.back().swap(merged);
+    }
+    CountBlockBytes();
+}
+
+void CooccurrenceCounts::MergeBlocks() {
+    if (!buffer_.empty() || !weighted_buffer_.empty()) { ReduceBuffer(); }
+    while (blocks_.size() > 1) {
+	vector<Record> merged;
+	MergeTwoBlocks(blocks_[blocks_.size() - 2], blocks_.back(), &merged);
+	blocks_.pop_back();
+	blocks_.back().swap(merged);
+    }
+    CountBlockBytes();
+}
+
+void CooccurrenceCounts::CountBlockBytes() {
+    block_bytes_ = 0;
+    for (const vector<Record> &block : blocks_) {
+	block_bytes_ += block.capacity() * sizeof(Record);
+    }
+}
+
+void CooccurrenceCounts::MergeTwoBlocks(const vector<Record> &block1,
+					const vector<Record> &block2,
+					vector<Record> *merged) {
+    merged->clear();
+    merged->reserve(block1.size() + block2.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < block1.size() || j < block2.size()) {
+	if (j == block2.size() ||
+	    (i < block1.size() && block1[i].key < block2[j].key)) {
+	    merged->push_back(block1[i++]);
+	} else if (i == block1.size() || block2[j].key < block1[i].key) {
+	    merged->push_back(block2[j++]);
+	} else {  // Same key
+	    merged->push_back({block1[i].key, block1[i].count + block2[j].count});
+	    ++i;
+	    ++j;
+	}
+    }
+}
+
+void CooccurrenceSketch::Initialize(size_t num_bytes, size_t num_candidates) {
+    width_ = 1024;
+    while (2 * width_ * kDepth * sizeof(uint64_t) <= num_bytes) { width_ *= 2; }
+    counters_.assign(kDepth * width_, 0);
+    total_ = 0;
+    num_candidates_ = max(num_candidates, (size_t) 1);
+    candidates_.clear();
+    candidate_threshold_ = 0;
+}
+
+void CooccurrenceSketch::Add(size_t context, size_t word, uint64_t count) {
+    uint64_t key = ((uint64_t) context << 32) | word;
+    size_t slots[kDepth];
+    uint64_t estimate = UINT64_MAX;
+    for (size_t row = 0; row < kDepth; ++row) {
+	slots[row] = Slot(row, key);
+	estimate = min(estimate, counters_[slots[row]]);
+    }
+
+    // Conservative update: raise only the counters below the new estimate.
+    estimate += count;
+    for (size_t row = 0; row < kDepth; ++row) {
+	counters_[slots[row]] = max(counters_[slots[row]], estimate);
+    }
+    total_ += count;
+    if (estimate > candidate_threshold_) {
+	candidates_[key] = estimate;
+	if (candidates_.size() > 2 * num_candidates_) { PruneCandidates(); }
+    }
+}
+
+uint64_t CooccurrenceSketch::Estimate(size_t context, size_t word) const {
+    uint64_t key = ((uint64_t) context << 32) | word;
+    uint64_t estimate = UINT64_MAX;
+    for (size_t row = 0; row < kDepth; ++row) {
+	estimate = min(estimate, counters_[Slot(row, key)]);
+    }
+    return estimate;
+}
+
+void CooccurrenceSketch::PruneCandidates() {
+    // Keep the candidates by rank, so that ties at the threshold cannot
+    // empty the table.
+    vector<pair<uint64_t, uint64_t> > ranked(candidates_.begin(),
+					      candidates_.end());
+    nth_element(ranked.begin(), ranked.begin() + num_candidates_ - 1,
+		ranked.end(), [](const pair<uint64_t, uint64_t> &left,
+				 const pair<uint64_t, uint64_t> &right) {
+		    return left.second > right.second;
+		});
+    candidate_threshold_ = ranked[num_candidates_ - 1].second;
+    for (size_t i = num_candidates_; i < ranked.size(); ++i) {
+	candidates_.erase(ranked[i].first);
+    }
+}
+
+double HyperLogLog::Estimate() const {
+    double num_registers = registers_.size();
+    double sum = 0.0;
+    size_t num_zeros = 0;
+    for (uint8_t reg : registers_) {
+	sum += ldexp(1.0, -reg);
+	if (reg == 0) { ++num_zeros; }
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / num_registers);
+    double estimate = alpha * num_registers * num_registers / sum;
+
+    // Linear counting is more accurate for few keys.
+    if (estimate <= 2.5 * num_registers && num_zeros > 0) {
+	estimate = num_registers * log(num_registers / num_zeros);
+    }
+    return estimate;
+}
@@ -0,0 +1,411 @@
+// Author: Karl Stratos (stratos@cs.columbia.edu)
+//
+// Code for storing co-occurrence counts compactly.
+
+#ifndef COUNTS_H
+#define COUNTS_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sparsesvd.h"
+#include "util.h"
+
+using namespace std;
+
+// Mixes the bits of a 64-bit key (the finalizer of MurmurHash3).
+inline uint64_t MixBits(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Counts of (context, word) pairs in a flat open-addressing hash table with
+// linear probing. A pair takes 12 bytes (kSlotBytes, packed): its key
+// (context << 32 | word) and a 32-bit count. A count that reaches 2^32 - 1
+// keeps the excess in a side map.
+//
+// Alternatively, pairs are counted by sort and reduce: keys are appended to a
+// buffer, and a full buffer is radix-sorted and reduced to a block of
+// (key, count) records sorted by key. Blocks are merged as they pile up, so
+// the counts end up sorted in column-major order for free. Memory is accessed
+// sequentially instead of at a random slot per pair.
+class CooccurrenceCounts {
+public:
+    // Initializes an empty table.
+    CooccurrenceCounts() { }
+
+    // Number of bytes of a slot of the table.
+    static const size_t kSlotBytes = 12;
+
+    // Counts pairs by sort and reduce from now on, with a buffer of the given
+    // number of pairs (must be empty).
+    void UseSortAndReduce(size_t buffer_size) {
+	ASSERT(size() == 0, "Cannot change the counting of nonempty counts");
+	buffer_size_ = max(buffer_size, (size_t) 1);
+    }
+
+    // Adds the given count to the pair of a context and a word (both must be
+    // less than 2^32 - 1).
+    void Add(size_t context, size_t word, uint64_t count = 1) {
+	uint64_t key = ((uint64_t) context << 32) | word;
+	if (buffer_size_ > 0) {
+	    if (count == 1) {
+		buffer_.push_back(key);
+	    } else {
+		weighted_buffer_.push_back({key, count});
+	    }
+	    if (buffer_.size() + weighted_buffer_.size() >= buffer_size_) {
+		ReduceBuffer();
+	    }
+	    return;
+	}
+	if ((num_pairs_ + 1) * 10 > entries_.size() * 7) { Grow(); }
+	Entry *entry = &entries_[Find(key)];
+	if (entry->key == kEmptyKey) {
+	    entry->key = key;
+	    entry->count = 0;
+	    ++num_pairs_;
+	}
+	uint64_t total = entry->count + count;
+	if (total >= UINT32_MAX) {  // Promote to the side map.
+	    overflow_[key] += total - UINT32_MAX;
+	    total = UINT32_MAX;
+	}
+	entry->count = total;
+    }
+
+    // Returns the count of the pair of a context and a word (0 if unseen).
+    uint64_t Get(size_t context, size_t word) const;
+
+    // Calls function(context, word, count) for each pair in no particular
+    // order.
+    template <class Function>
+    void ForEach(Function function) {
+	if (buffer_size_ > 0) {
+	    MergeBlocks();
+	    for (const Record &record : Sorted()) {
+		function(record.key >> 32, record.key & UINT32_MAX,
+			 record.count);
+	    }
+	    return;
+	}
+	for (const Entry &entry : entries_) {
+	    if (entry.key == kEmptyKey) { continue; }
+	    function(entry.key >> 32, entry.key & UINT32_MAX,
+		     Total(entry));
+	}
+    }
+
+    // Makes room for the given number of distinct pairs so that the table
+    // does not grow until they are all added (no effect under sort and
+    // reduce).
+    void Reserve(size_t num_pairs);
+
+    // Returns the number of slots the table needs to hold the given number of
+    // distinct pairs without growing.
+    static size_t NumSlots(size_t num_pairs) {
+	size_t num_slots = 1024;
+	while (num_slots * 7 < (num_pairs + 1) * 10) { num_slots *= 2; }
+	return num_slots;
+    }
+
+    // Returns the number of distinct pairs (under sort and reduce, an upper
+    // bound while pairs are not all reduced).
+    size_t size() const;
+
+    // Returns the number of bytes taken by the table (or the buffers and
+    // blocks).
+    size_t memory_usage() const {
+	return entries_.size() * sizeof(Entry) + block_bytes_ +
+	    (buffer_.capacity() + sort_space_.capacity()) * sizeof(uint64_t) +
+	    weighted_buffer_.capacity() * sizeof(Record);
+    }
+
+    // Returns the most bytes the counts can take while the given number of
+    // new pairs is added: the old and new slots while the table grows (or
+    // two blocks and their merge under sort and reduce).
+    size_t peak_memory_usage(size_t num_new_pairs) const {
+	if (buffer_size_ > 0) { return 2 * memory_usage(); }
+	if ((num_pairs_ + num_new_pairs + 1) * 10 <= entries_.size() * 7) {
+	    return memory_usage();
+	}
+	return memory_usage() + max(2 * entries_.size(), (size_t) 1024) *
+	    sizeof(Entry);
+    }
+
+    // Converts the counts into a sparse matrix M for SVDLIBC with
+    // M_{word,context} = count, rows sorted within each column. The pairs
+    // are sorted in place with the given number of threads, and the table
+    // is emptied. The caller owns (and frees) the matrix.
+    SMat ToSparseMatrix(size_t num_rows, size_t num_columns,
+			size_t num_threads);
+
+    // Writes the pairs sorted by (context, word) to a binary run file and
+    // empties the table. The pairs are sorted in place with the given number
+    // of threads.
+    void WriteRun(const string &file_path, size_t num_threads);
+
+    // Adds the pairs of a run file with contexts and words renumbered by the
+    // given maps (an empty map keeps the numbers as they are).
+    void AddRun(const string &file_path, const vector<size_t> &context_map,
+		const vector<size_t> &word_map);
+
+    // Calls function(context, word, count) for each pair of a run file in
+    // order, reading the file a block at a time.
+    template <class Function>
+    static void ForEachInRun(const string &file_path, Function function) {
+	ifstream file(file_path, ios::in | ios::binary);
+	ASSERT(file.is_open(), "Cannot open file: " << file_path);
+	vector<Record> block(kRecordsPerBlock);
+	while (file.read((char *) block.data(),
+			 block.size() * sizeof(Record)) || file.gcount() > 0) {
+	    size_t num_records = file.gcount() / sizeof(Record);
+	    for (size_t i = 0; i < num_records; ++i) {
+		function(block[i].key >> 32, block[i].key & UINT32_MAX,
+			 block[i].count);
+	    }
+	}
+    }
+
+    // Merges run files into a sparse matrix file in the format of
+    // SparseSVDSolver (M_{word,context} = count), summing the counts of a
+    // pair found in several runs, and on the fly computes the row/column
+    // sums. The runs are streamed, so the matrix is never held in memory.
+    static void MergeRuns(const vector<string> &run_paths, size_t num_rows,
+			  size_t num_columns, const string &file_path,
+			  vector<double> *row_sum, vector<double> *column_sum);
+
+    // Removes all pairs and frees memory.
+    void Clear();
+
+private:
+    // A slot of the table, packed so that the count takes 4 bytes.
+    struct __attribute__((packed)) Entry {
+	uint64_t key;
+	uint32_t count;
+    };
+    static_assert(sizeof(Entry) == kSlotBytes, "Entry must be packed");
+
+    // A pair in a run file or a block.
+    struct Record {
+	uint64_t key;
+	uint64_t count;
+    };
+
+    // Key of an empty slot (not a valid pair).
+    static const uint64_t kEmptyKey = UINT64_MAX;
+
+    // Number of records read or written at a time in run files.
+    static const size_t kRecordsPerBlock = 4096;
+
+    // Number of bits of a radix-sort digit.
+    static const size_t kRadixBits = 16;
+
+    // Moves the pairs to the front of the table and sorts them by key.
+    void SortInPlace(size_t num_threads);
+
+    // Sorts the pairs by key in place with the given number of threads (or
+    // under sort and reduce, merges them into a single block) and returns
+    // the number of distinct pairs.
+    size_t Sort(size_t num_threads);
+
+    // Calls function(key, count) for each pair in order of key (after Sort).
+    template <class Function>
+    void ForEachSorted(Function function) {
+	if (buffer_size_ > 0) {
+	    for (const Record &record : Sorted()) {
+		function(record.key, record.count);
+	    }
+	} else {
+	    for (const Entry &entry : entries_) {
+		function(entry.key, Total(entry));
+	    }
+	}
+    }
+
+    // Radix-sorts the buffered keys, reduces them with the weighted pairs to
+    // a block, and merges the last blocks while the older of the two is at
+    // most twice as large as the newer.
+    void ReduceBuffer();
+
+    // Reduces the buffer and merges all blocks into a single block.
+    void MergeBlocks();
+
+    // Sets block_bytes_ to the number of bytes taken by the blocks.
+    void CountBlockBytes();
+
+    // Returns the pairs of the single block after merging (empty if none).
+    const vector<Record> &Sorted() {
+	if (blocks_.empty()) { blocks_.resize(1); }
+	return blocks_[0];
+    }
+
+    // Merges two blocks sorted by key into one, summing the counts of a key
+    // found in both.
+    static void MergeTwoBlocks(const vector<Record> &block1,
+			       const vector<Record> &block2,
+			       vector<Record> *merged);
+
+    // Returns the slot holding the key, or the empty slot where it belongs.
+    size_t Find(uint64_t key) const {
+	size_t mask = entries_.size() - 1;
+	size_t slot = MixBits(key) & mask;
+	while (entries_[slot].key != key && entries_[slot].key != kEmptyKey) {
+	    slot = (slot + 1) & mask;
+	}
+	return slot;
+    }
+
+    // Returns the total count of an occupied slot.
+    uint64_t Total(const Entry &entry) const {
+	return (entry.count < UINT32_MAX) ?
+	    entry.count : UINT32_MAX + overflow_.at(entry.key);
+    }
+
+    // Doubles the number of slots (at least 1024) and reinserts the pairs.
+    void Grow() { Resize(max(2 * entries_.size(), (size_t) 1024)); }
+
+    // Changes the number of slots (a power of 2 larger than the number of
+    // pairs) and reinserts the pairs.
+    void Resize(size_t num_slots);
+
+    // Slots of the table (the size is a power of 2).
+    vector<Entry> entries_;
+
+    // Number of occupied slots.
+    size_t num_pairs_ = 0;
+
+    // Counts beyond 2^32 - 1 of the keys whose 32-bit count is saturated.
+    unordered_map<uint64_t, uint64_t> overflow_;
+
+    // Number of pairs buffered before they are reduced (0 means the hash
+    // table is used instead).
+    size_t buffer_size_ = 0;
+
+    // Keys of buffered pairs with count 1, and buffered pairs with other
+    // counts.
+    vector<uint64_t> buffer_;
+    vector<Record> weighted_buffer_;
+
+    // Space for radix-sorting the buffer.
+    vector<uint64_t> sort_space_;
+
+    // Blocks of reduced pairs sorted by key, older and larger blocks first,
+    // and the number of bytes they take.
+    vector<vector<Record> > blocks_;
+    size_t block_bytes_ = 0;
+};
+
+// Approximate counts of (context, word) pairs in a count-min sketch with
+// conservative update: kDepth rows of counters, a pair hashed to one counter
+// in each row. The estimate of a pair (its smallest counter) is never below
+// its count, and with probability 1 - e^-kDepth it is above by at most
+// e / width times the total count. Pairs with the largest estimates so far
+// are kept as candidates for the heaviest pairs.
+class CooccurrenceSketch {
+public:
+    // Initializes an empty sketch (with no counters).
+    CooccurrenceSketch() { }
+
+    // Allocates counters in about the given number of bytes and keeps up to
+    // the given number of candidates (holding up to twice as many between
+    // prunings). Pairs added before are forgotten.
+    void Initialize(size_t num_bytes, size_t num_candidates);
+
+    // Returns true if the sketch has counters.
+    bool initialized() const { return !counters_.empty(); }
+
+    // Adds the given count to the pair of a context and a word.
+    void Add(size_t context, size_t word, uint64_t count);
+
+    // Returns the estimated count of the pair of a context and a word.
+    uint64_t Estimate(size_t context, size_t word) const;
+
+    // Calls function(context, word) for each candidate pair.
+    template <class Function>
+    void ForEachCandidate(Function function) const {
+	for (const auto &candidate_pair : candidates_) {
+	    function(candidate_pair.first >> 32,
+		     candidate_pair.first & UINT32_MAX);
+	}
+    }
+
+    // Returns the number of counters in a row.
+    size_t width() const { return width_; }
+
+    // Returns the total count added.
+    uint64_t total() const { return total_; }
+
+    // Number of rows.
+    static const size_t kDepth = 4;
+
+private:
+    // Returns the index of the counter of the key in the given row.
+    size_t Slot(size_t row, uint64_t key) const {
+	return row * width_ +
+	    (MixBits(key + row * 0x9e3779b97f4a7c15ULL) & (width_ - 1));
+    }
+
+    // Keeps the num_candidates_ candidates with the largest estimates (ties
+    // broken arbitrarily). The smallest estimate kept becomes the estimate to
+    // beat to be a candidate.
+    void PruneCandidates();
+
+    // Rows of counters, one after another.
+    vector<uint64_t> counters_;
+
+    // Number of counters in a row (a power of 2).
+    size_t width_ = 0;
+
+    // Total count added.
+    uint64_t total_ = 0;
+
+    // Maximum number of candidates kept after pruning.
+    size_t num_candidates_ = 0;
+
+    // Candidate keys with their estimates when last added (the table holds
+    // up to twice num_candidates_ between prunings).
+    unordered_map<uint64_t, uint64_t> candidates_;
+
+    // Pairs with an estimate above this become candidates.
+    uint64_t candidate_threshold_ = 0;
+};
+
+// Estimates the number of distinct keys added with HyperLogLog: a key is
+// hashed to one of 2^kPrecision registers, which keeps the largest number of
+// leading zeros (plus 1) seen in the rest of the hashes. The relative error
+// is about 1.04 / 2^(kPrecision / 2), under 1% for 2^14 registers.
+class HyperLogLog {
+public:
+    // Initializes with no keys.
+    HyperLogLog() : registers_(1 << kPrecision, 0) { }
+
+    // Adds a key.
+    void Add(uint64_t key) {
+	uint64_t hash = MixBits(key);
+	uint8_t &reg = registers_[hash >> (64 - kPrecision)];
+	uint64_t rest = hash << kPrecision;
+	uint8_t rank = (rest == 0) ? 64 - kPrecision + 1 :
+	    __builtin_clzll(rest) + 1;
+	if (rank > reg) { reg = rank; }
+    }
+
+    // Returns the estimated number of distinct keys added.
+    double Estimate() const;
+
+    // Number of bits of a hash that choose its register.
+    static const size_t kPrecision = 14;
+
+private:
+    // Largest rank seen by each register.
+    vector<uint8_t> registers_;
+};
+
+#endif  // COUNTS_H
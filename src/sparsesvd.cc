@@ -2,8 +2,10 @@
 
 #include "sparsesvd.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
+#include <limits>
 #include <math.h>
 #include <sstream>
 
@@ -52,6 +54,7 @@ void SparseSVDSolver::WriteSparseMatrix(
     size_t num_nonzeros) {
     ofstream file(file_path, ios::out);
     ASSERT(file.is_open(), "Cannot open file: " << file_path);
+    file << setprecision(numeric_limits<double>::max_digits10);  // Lossless
     file << num_rows << " " << num_columns << " " << num_nonzeros << endl;
     for (size_t col = 0; col < num_columns; ++col) {
 	if (column_map.find(col) == column_map.end()) {
@@ -76,14 +79,18 @@ void SparseSVDSolver::WriteSparseMatrix(
     column_sum->clear();
     ofstream file(file_path, ios::out);
     ASSERT(file.is_open(), "Cannot open file: " << file_path);
+    file << setprecision(numeric_limits<double>::max_digits10);  // Lossless
     file << num_rows << " " << num_columns << " " << num_nonzeros << endl;
     for (size_t col = 0; col < num_columns; ++col) {
 	if (column_map.find(col) == column_map.end()) {
 	    file << 0 << endl;
 	    continue;
 	}
-	file << column_map.at(col).size() << endl;
-	for (const auto &row_pair: column_map.at(col)) {
+	vector<pair<size_t, double> > sorted_column(column_map.at(col).begin(),
+						    column_map.at(col).end());
+	sort(sorted_column.begin(), sorted_column.end());
+	file << sorted_column.size() << endl;
+	for (const auto &row_pair: sorted_column) {
 	    size_t row = row_pair.first;
 	    double value = row_pair.second;
 	    file << row << " " << value << endl;
@@ -93,6 +100,31 @@ void SparseSVDSolver::WriteSparseMatrix(
     }
 }
 
+void SparseSVDSolver::WriteSparseMatrix(SMat sparse_matrix,
+					const string file_path,
+					vector<double> *row_sum,
+					vector<double> *column_sum) {
+    row_sum->assign(sparse_matrix->rows, 0.0);
+    column_sum->assign(sparse_matrix->cols, 0.0);
+    ofstream file(file_path, ios::out);
+    ASSERT(file.is_open(), "Cannot open file: " << file_path);
+    file << setprecision(numeric_limits<double>::max_digits10);  // Lossless
+    file << sparse_matrix->rows << " " << sparse_matrix->cols << " "
+	 << sparse_matrix->vals << endl;
+    for (long col = 0; col < sparse_matrix->cols; ++col) {
+	file << sparse_matrix->pointr[col + 1] - sparse_matrix->pointr[col]
+	     << endl;
+	for (long i = sparse_matrix->pointr[col];
+	     i < sparse_matrix->pointr[col + 1]; ++i) {
+	    long row = sparse_matrix->rowind[i];
+	    double value = sparse_matrix->value[i];
+	    file << row << " " << value << endl;
+	    (*row_sum)[row] += value;
+	    (*column_sum)[col] += value;
+	}
+    }
+}
+
 void SparseSVDSolver::LoadSparseMatrix(
     const unordered_map<size_t, unordered_map<size_t, double> > &column_map) {
     // Compute the number of dimensions and nonzero values.
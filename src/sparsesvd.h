@@ -50,7 +50,8 @@ public:
 	size_t num_columns, size_t num_nonzeros);
 
     // Writes a sparse matrix as a file (fast), and on the fly compute the
-    // row/column sum.
+    // row/column sum. Rows are written in increasing order within each column
+    // so that the file does not depend on the hashing order of the map.
     void WriteSparseMatrix(
 	const unordered_map<size_t, unordered_map<size_t, double> >
 	&column_map, const string file_path, size_t num_rows,
@@ -58,6 +59,11 @@ public:
 	unordered_map<size_t, double> *row_sum,
 	unordered_map<size_t, double> *column_sum);
 
+    // Writes a sparse matrix in SVDLIBC's (column-major) format as a file,
+    // and on the fly compute the row/column sums.
+    void WriteSparseMatrix(SMat sparse_matrix, const string file_path,
+			   vector<double> *row_sum, vector<double> *column_sum);
+
     // Loads a sparse matrix M for SVD: column_map[j][i] = M_{i,j}.
     void LoadSparseMatrix(
 	const unordered_map<size_t, unordered_map<size_t, double> >
@@ -6,9 +6,15 @@
 #include <dirent.h>
 #include <math.h>
 #include <random>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 void StringManipulator::Split(const string &line, const string &delimiter,
 			      vector<string> *tokens) {
     tokens->clear();
@@ -29,6 +35,53 @@ void StringManipulator::Split(const string &line, const string &delimiter,
     }
 }
 
+void StringManipulator::Split(const StringPiece &line, char delimiter,
+			      vector<StringPiece> *tokens) {
+    tokens->clear();
+    size_t token_start = string::npos;  // Start of the current token, if any.
+    size_t position = 0;
+#ifdef __SSE2__
+    // Find delimiters 16 bytes at a time: bit i of the mask is set if the
+    // i-th byte of the block is a delimiter.
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    for (; position + 16 <= line.size; position += 16) {
+	__m128i block = _mm_loadu_si128((const __m128i *)
+					(line.data + position));
+	uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, delimiters));
+	uint32_t unseen = 0xFFFF;  // Bytes of the block not yet looked at.
+	while (true) {
+	    // Token start => next delimiter, otherwise => next non-delimiter.
+	    uint32_t wanted = ((token_start != string::npos) ? mask : ~mask) &
+		unseen;
+	    if (wanted == 0) { break; }
+	    size_t offset = __builtin_ctz(wanted);
+	    if (token_start != string::npos) {
+		tokens->push_back({line.data + token_start,
+			    position + offset - token_start});
+		token_start = string::npos;
+	    } else {
+		token_start = position + offset;
+	    }
+	    unseen = 0xFFFF & (~0u << offset);
+	}
+    }
+#endif
+    for (; position < line.size; ++position) {
+	if (line.data[position] == delimiter) {
+	    if (token_start != string::npos) {
+		tokens->push_back({line.data + token_start,
+			    position - token_start});
+		token_start = string::npos;
+	    }
+	} else if (token_start == string::npos) {
+	    token_start = position;
+	}
+    }
+    if (token_start != string::npos) {
+	tokens->push_back({line.data + token_start, line.size - token_start});
+    }
+}
+
 string StringManipulator::TimeString(double num_seconds) {
     size_t num_hours = (int) floor(num_seconds / 3600.0);
     double num_seconds_minus_h = num_seconds - (num_hours * 3600);
@@ -84,6 +137,10 @@ string FileManipulator::FileType(const string &file_path) {
 
 void FileManipulator::ListFiles(const string &file_path, vector<string> *list) {
     (*list).clear();
+    if (file_path == "-") {  // Standard input
+	(*list).push_back(file_path);
+	return;
+    }
     string file_type = FileType(file_path);
     if (file_type == "dir") {
 	DIR *pDIR = opendir(file_path.c_str());
@@ -103,13 +160,25 @@ void FileManipulator::ListFiles(const string &file_path, vector<string> *list) {
     }
 }
 
-size_t FileManipulator::NumLines(const string &file_path) {
-    size_t num_lines = 0;
+size_t FileManipulator::Size(const string &file_path) {
+    if (file_path == "-") { return 0; }  // Standard input
+    struct stat stat_buffer;
+    ASSERT(stat(file_path.c_str(), &stat_buffer) == 0,
+	   "Problem with " << file_path);
+    return stat_buffer.st_size;
+}
+
+size_t FileManipulator::ModificationTime(const string &file_path) {
+    struct stat stat_buffer;
+    ASSERT(stat(file_path.c_str(), &stat_buffer) == 0,
+	   "Problem with " << file_path);
+    return stat_buffer.st_mtime;
+}
+
+string FileManipulator::Content(const string &file_path) {
     ifstream file(file_path, ios::in);
-    ASSERT(file.is_open(), "Cannot open file: " << file_path);
-    string line;
-    while (getline(file, line)) { ++num_lines; }
-    return num_lines;
+    return string((istreambuf_iterator<char>(file)),
+		  istreambuf_iterator<char>());
 }
 
 void FileManipulator::Write(const Eigen::MatrixXd &m, const string &file_path) {
@@ -264,3 +333,82 @@ void Stat::AverageRankTransform(const vector<double> &values,
 	transformed_values->push_back(averaged_ranks[index]);
     }
 }
+
+size_t AvailableMemory() {
+    ifstream meminfo_file("/proc/meminfo", ios::in);
+    string line;
+    while (getline(meminfo_file, line)) {
+	if (line.compare(0, 13, "MemAvailable:") == 0) {
+	    return stol(line.substr(13)) << 10;  // In kB
+	}
+    }
+    return (size_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+ProgressReporter::ProgressReporter(size_t num_units, double interval) :
+    num_units_(num_units), interval_(interval),
+    begin_time_(chrono::steady_clock::now()) {
+    next_report_ = (num_units_ > 0) ?
+	max((size_t) (interval_ * num_units_), (size_t) 1) : kUnknownInterval;
+}
+
+void ProgressReporter::StartLine(const string &label) {
+    label_ = label;
+    line_length_ = label_.size();
+    cerr << label_ << flush;
+}
+
+void ProgressReporter::EndLine(const string &message) {
+    cerr << message << endl;
+    line_length_ = 0;
+}
+
+void ProgressReporter::Add(size_t num_units, size_t num_tokens) {
+    lock_guard<mutex> lock(add_mutex_);
+    num_units_added_ += num_units;
+    num_tokens_added_ += num_tokens;
+    Update(num_units_added_, num_tokens_added_);
+}
+
+void ProgressReporter::Report(size_t num_units_done, size_t num_tokens) {
+    if (shared_ != nullptr) {
+	shared_->Add(num_units_done - num_units_shared_,
+		     num_tokens - num_tokens_shared_);
+	num_units_shared_ = num_units_done;
+	num_tokens_shared_ = num_tokens;
+    } else if (num_units_ == 0) {
+	string line = label_ + " " + to_string(num_units_done >> 20) + "M (" +
+	    Rate(num_tokens) + ")";
+	cerr << "\r" << line << flush;
+	line_length_ = line.size();
+    } else {
+	double num_seconds = ElapsedSeconds();
+	double fraction = min((double) num_units_done / num_units_, 1.0);
+	StringManipulator string_manipulator;
+	string line = label_ + " " + to_string((int) (100 * fraction)) +
+	    "% (" + Rate(num_tokens) + ", ETA " +
+	    string_manipulator.TimeString(num_seconds * (1 - fraction) /
+					  max(fraction, 1e-6)) + ")";
+	cerr << "\r" << line << string((line_length_ > line.size()) ?
+					line_length_ - line.size() : 0, ' ')
+	     << flush;
+	line_length_ = line.size();
+    }
+    if (num_units_ == 0) {
+	next_report_ = num_units_done + kUnknownInterval;
+    } else {
+	double fraction = min((double) num_units_done / num_units_, 1.0);
+	next_report_ = (floor(fraction / interval_) + 1) * interval_ *
+	    num_units_;
+    }
+}
+
+string ProgressReporter::Rate(size_t num_tokens) {
+    return to_string((size_t) (num_tokens / max(ElapsedSeconds(), 1e-3))) +
+	" tokens/sec";
+}
+
+double ProgressReporter::ElapsedSeconds() {
+    return chrono::duration<double>(chrono::steady_clock::now() -
+				    begin_time_).count();
+}
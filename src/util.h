@@ -6,15 +6,25 @@
 #define UTIL_H_
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 using namespace std;
 
+// Read-only view of characters owned elsewhere (e.g., a memory-mapped file).
+struct StringPiece {
+    const char *data;
+    size_t size;
+};
+
 // Class for manipulating strings.
 class StringManipulator {
 public:
@@ -22,6 +32,12 @@ public:
     void Split(const string &line, const string &delimiter,
 	       vector<string> *tokens);
 
+    // Splits the given piece of a line by a delimiter character into pieces
+    // of that line (a run of delimiters gives no empty token). This does not
+    // allocate memory once the vector has enough capacity.
+    void Split(const StringPiece &line, char delimiter,
+	       vector<StringPiece> *tokens);
+
     // Returns the hour/minute/second string of seconds: 6666 => "1h51m6s".
     string TimeString(double num_seconds);
 
@@ -44,11 +60,18 @@ public:
 
     // List files. If given a single file, the list contains the path to that
     // file. If given a directory, the list contains the paths to the files
-    // inside that directory (non-recursively).
+    // inside that directory (non-recursively). Standard input ("-") is listed
+    // as itself.
     void ListFiles(const string &file_path, vector<string> *list);
 
-    // Returns the number of lines in a file.
-    size_t NumLines(const string &file_path);
+    // Returns the size of a file in bytes (0 for standard input "-").
+    size_t Size(const string &file_path);
+
+    // Returns the last modification time of a file (seconds since the epoch).
+    size_t ModificationTime(const string &file_path);
+
+    // Returns the content of a file as a string (empty if it does not exist).
+    string Content(const string &file_path);
 
     // Writes an Eigen matrix to a text file.
     void Write(const Eigen::MatrixXd &m, const string &file_path);
@@ -85,6 +108,82 @@ public:
 			      vector<double> *transformed_values);
 };
 
+// Returns the number of bytes of memory available without swapping
+// (MemAvailable in /proc/meminfo, or else the free physical memory).
+size_t AvailableMemory();
+
+// Reports on stderr the progress of work measured in units known in advance
+// (e.g., bytes of a corpus): at every given fraction of the work, the line of
+// the current label is rewritten with the percentage done, the rate of tokens
+// per second, and the estimated time left. If the amount of work is unknown,
+// the units done and the rate are reported every kUnknownInterval units.
+class ProgressReporter {
+public:
+    // Starts the clock for the given number of units of work (0 if unknown).
+    ProgressReporter(size_t num_units, double interval);
+
+    // Starts a new line with the given label.
+    void StartLine(const string &label);
+
+    // Updates the units done and tokens processed so far (both cumulative).
+    void Update(size_t num_units_done, size_t num_tokens) {
+	if (num_units_done >= next_report_) {
+	    Report(num_units_done, num_tokens);
+	}
+    }
+
+    // Ends the current line with the given message.
+    void EndLine(const string &message);
+
+    // Passes the progress to a reporter shared by several threads at each
+    // report, instead of writing it.
+    void ShareWith(ProgressReporter *shared) { shared_ = shared; }
+
+    // Adds units done and tokens processed by one of the threads sharing the
+    // reporter.
+    void Add(size_t num_units, size_t num_tokens);
+
+    // Rewrites the current line with the progress (or passes it to the shared
+    // reporter), whether or not a report is due.
+    void Report(size_t num_units_done, size_t num_tokens);
+
+private:
+    // Returns the rate of tokens processed since the clock started.
+    string Rate(size_t num_tokens);
+
+    // Returns the seconds since the clock started.
+    double ElapsedSeconds();
+
+    // Units between reports if the amount of work is unknown.
+    static const size_t kUnknownInterval = 1 << 26;
+
+    // Total units of work.
+    size_t num_units_;
+
+    // Fraction of the work between reports.
+    double interval_;
+
+    // Units done at which the next report is due.
+    size_t next_report_;
+
+    // Label of the current line and the length of the line written so far.
+    string label_;
+    size_t line_length_ = 0;
+
+    // Time at which the clock started.
+    chrono::steady_clock::time_point begin_time_;
+
+    // Reporter the progress is passed to, and the progress passed so far.
+    ProgressReporter *shared_ = nullptr;
+    size_t num_units_shared_ = 0;
+    size_t num_tokens_shared_ = 0;
+
+    // Progress added by the threads sharing the reporter.
+    mutex add_mutex_;
+    size_t num_units_added_ = 0;
+    size_t num_tokens_added_ = 0;
+};
+
 // Assert macro that allows adding a message to an assertion upon failure. It
 // implictly performs string conversion: ASSERT(x > 0, "Negative x: " << x);
 #ifndef NDEBUG
@@ -110,6 +209,37 @@ struct sort_pairs_second {
     }
 };
 
+// Template for sorting [first, last) with num_threads threads: blocks are
+// sorted concurrently and then merged pairwise. Use it like:
+//    parallel_sort(v.begin(), v.end(), less<int>(), 4);
+template <class RandomIt, class Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp,
+		   size_t num_threads) {
+    size_t num_elements = last - first;
+    size_t num_blocks = min(max(num_threads, (size_t) 1),
+			    max(num_elements / 1000, (size_t) 1));
+    vector<RandomIt> bounds;
+    for (size_t block = 0; block <= num_blocks; ++block) {
+	bounds.push_back(first + block * num_elements / num_blocks);
+    }
+    vector<thread> workers;
+    for (size_t block = 0; block < num_blocks; ++block) {
+	workers.push_back(thread([&, block]() {
+		    sort(bounds[block], bounds[block + 1], comp); }));
+    }
+    for (thread &worker : workers) { worker.join(); }
+    for (size_t width = 1; width < num_blocks; width *= 2) {
+	workers.clear();
+	for (size_t block = 0; block + width < num_blocks; block += 2 * width) {
+	    RandomIt middle = bounds[block + width];
+	    RandomIt end = bounds[min(block + 2 * width, num_blocks)];
+	    workers.push_back(thread([&, block, middle, end]() {
+			inplace_merge(bounds[block], middle, end, comp); }));
+	}
+	for (thread &worker : workers) { worker.join(); }
+    }
+}
+
 // Template for string conversion of floating points with precision.
 template <typename T>
 string to_string_with_precision(const T value, const int precision = 2) {
@@ -2,12 +2,18 @@
 
 #include "wordrep.h"
 
+#include <cmath>
 #include <dirent.h>
 #include <iomanip>
 #include <limits>
 #include <map>
+#include <memory>
+#include <string.h>
+#include <thread>
+#include <tuple>
 
 #include "cluster.h"
+#include "corpus.h"
 #include "evaluate.h"
 #include "sparsesvd.h"
 
@@ -44,9 +50,393 @@ void WordRep::ResetOutputDirectory() {
 }
 
 void WordRep::ExtractStatistics(const string &corpus_file) {
+    FileManipulator file_manipulator;
+    if (corpus_file == "-") {
+	ASSERT(configurations_.empty() &&
+	       (single_pass_ ||
+		file_manipulator.Exists(SortedWordTypesPath())),
+	       "Standard input can be read only once: use --onepass");
+    }
+    if (!configurations_.empty()) {
+	CountWords(corpus_file);
+	SlideWindows(corpus_file);
+    } else if (single_pass_ &&
+	       !file_manipulator.Exists(SortedWordTypesPath())) {
+	SlideWindow(corpus_file, true);  // Also counts words.
+    } else {
+	CountWords(corpus_file);
+	DetermineRareWords();
+	SlideWindow(corpus_file, false);
+    }
+}
+
+void WordRep::AppendCorpus(const string &corpus_file) {
+    log_ << endl << "[Appending to the corpus]" << endl;
+    ASSERT(corpus_file != "-", "Cannot append standard input");
+    ASSERT(configurations_.empty() && num_context_hashed_ == 0 &&
+	   sketch_memory_ == 0, "Cannot append with --configs, --hash or "
+	   "--sketch");
+    FileManipulator file_manipulator;
+    vector<string> file_list;
+    file_manipulator.ListFiles(corpus_file, &file_list);
+    sort(file_list.begin(), file_list.end());  // Append in a fixed order.
+
+    // Add the word counts of files not yet counted.
+    vector<string> new_files;
+    ASSERT(file_manipulator.Exists(WordManifestPath()) ||
+	   !file_manipulator.Exists(SortedWordTypesPath()), "Words were not "
+	   "counted with --append: start over with -f");
+    FilesNotInManifest(file_list, WordManifestPath(), &new_files);
+    log_ << "   New files for word counts: " << new_files.size() << endl;
+    if (!new_files.empty()) {
+	unordered_map<string, size_t> wordcount;
+	size_t num_words = 0;
+	ifstream sorted_word_types_file(SortedWordTypesPath(), ios::in);
+	string line;
+	vector<string> tokens;
+	StringManipulator string_manipulator;
+	while (getline(sorted_word_types_file, line)) {
+	    if (line == "") { continue; }
+	    string_manipulator.Split(line, " ", &tokens);
+	    wordcount[tokens[0]] = stol(tokens[1]);
+	    num_words += stol(tokens[1]);
+	}
+	CountWordsInFiles(new_files, &wordcount, &num_words);
+	vector<pair<string, size_t> > sorted_wordcount(wordcount.begin(),
+						       wordcount.end());
+	unordered_map<string, size_t>().swap(wordcount);
+	WriteWordCounts(corpus_file, num_words, &sorted_wordcount);
+	AddToManifest(new_files, WordManifestPath());
+    }
+
+    // Add the co-occurrence counts of files not yet counted. These are kept
+    // under rare cutoff 0 so that words that are no longer rare can be told
+    // apart in the counts of earlier files.
+    size_t rare_cutoff = rare_cutoff_;
+    bool cache_tokens = cache_tokens_;
+    rare_cutoff_ = 0;
+    cache_tokens_ = false;  // The cache would hold only the new files.
+    ASSERT(file_manipulator.Exists(CountManifestPath()) ||
+	   !file_manipulator.Exists(CountWordContextPath()), "Counts were not "
+	   "made with --append: start over with -f");
+    FilesNotInManifest(file_list, CountManifestPath(), &new_files);
+    log_ << "   New files for co-occurrence counts: " << new_files.size()
+	 << endl << flush;
+    bool counts_changed = !new_files.empty();
+    if (counts_changed) {
+	// Set aside the counts so far, count the new files, and add the two.
+	vector<string> count_paths = {ContextStr2NumPath(),
+				      CountWordContextPath(), CountWordPath(),
+				      CountContextPath()};
+	bool has_counts = file_manipulator.Exists(CountWordContextPath());
+	unordered_map<string, Context> old_context_str2num;
+	unordered_map<Context, string> old_context_num2str;
+	unordered_map<Word, string> old_word_num2str;
+	SMat old_counts = nullptr;
+	if (has_counts) {
+	    // The counts keep the word IDs they were made with, which appending
+	    // for another configuration may have changed since.
+	    LoadWordDictionary(file_manipulator.Exists(CountWordStr2NumPath()) ?
+			       CountWordStr2NumPath() : WordStr2NumPath());
+	    LoadContextDictionary();
+	    SparseSVDSolver sparsesvd_solver;
+	    old_counts = sparsesvd_solver.ReadSparseMatrixFromFile(
+		CountWordContextPath());
+	    old_context_str2num.swap(context_str2num_);
+	    old_context_num2str.swap(context_num2str_);
+	    old_word_num2str.swap(word_num2str_);
+	    for (const string &count_path : count_paths) {
+		remove(count_path.c_str());
+	    }
+	}
+	DetermineRareWords();
+	SlideWindow(corpus_file, new_files, false);
+	if (has_counts) {
+	    AddCounts(old_counts, old_word_num2str, old_context_str2num,
+		      old_context_num2str);
+	    svdFreeSMat(old_counts);
+	}
+	ofstream count_word_str2num_file(CountWordStr2NumPath(), ios::out);
+	count_word_str2num_file << file_manipulator.Content(WordStr2NumPath());
+	count_word_str2num_file.close();
+	ASSERT(count_word_str2num_file.good(), "Cannot write file: "
+	       << CountWordStr2NumPath());
+	AddToManifest(new_files, CountManifestPath());
+	RemoveDerivedFiles(false);
+    }
+    rare_cutoff_ = rare_cutoff;
+    cache_tokens_ = cache_tokens;
+
+    // Fold the words that are rare under the actual cutoff.
+    if (rare_cutoff_ > 0) {
+	if (counts_changed) { RemoveDerivedFiles(true); }
+	RebucketCounts(0);
+    }
+}
+
+void WordRep::FilesNotInManifest(const vector<string> &file_list,
+				 const string &manifest_path,
+				 vector<string> *new_files) {
+    // A line of a manifest: size, modification time, path.
+    unordered_map<string, pair<size_t, size_t> > manifest;
+    ifstream manifest_file(manifest_path, ios::in);
+    string line;
+    while (getline(manifest_file, line)) {
+	size_t space1 = line.find(' ');
+	size_t space2 = line.find(' ', space1 + 1);
+	ASSERT(space2 != string::npos, "Bad manifest line: " << line);
+	manifest[line.substr(space2 + 1)] =
+	    make_pair(stol(line.substr(0, space1)),
+		      stol(line.substr(space1 + 1, space2 - space1 - 1)));
+    }
+    FileManipulator file_manipulator;
+    new_files->clear();
+    for (const string &file_path : file_list) {
+	auto file_pair = manifest.find(file_path);
+	if (file_pair == manifest.end()) {
+	    new_files->push_back(file_path);
+	    continue;
+	}
+	ASSERT(file_pair->second.first == file_manipulator.Size(file_path) &&
+	       file_pair->second.second ==
+	       file_manipulator.ModificationTime(file_path), "Changed since "
+	       "counted: " << file_path << " (start over with -f)");
+    }
+}
+
+void WordRep::AddToManifest(const vector<string> &file_list,
+			    const string &manifest_path) {
+    FileManipulator file_manipulator;
+    ofstream manifest_file(manifest_path, ios::out | ios::app);
+    for (const string &file_path : file_list) {
+	manifest_file << file_manipulator.Size(file_path) << " "
+		      << file_manipulator.ModificationTime(file_path) << " "
+		      << file_path << endl;
+    }
+    ASSERT(manifest_file.good(), "Cannot write file: " << manifest_path);
+}
+
+void WordRep::AddCounts(SMat old_counts,
+			const unordered_map<Word, string> &old_word_num2str,
+			const unordered_map<string, Context> &old_context_str2num,
+			const unordered_map<Context, string> &old_context_num2str) {
+    LoadWordDictionary();
+    LoadContextDictionary();
+    SparseSVDSolver sparsesvd_solver;
+    SMat new_counts = sparsesvd_solver.ReadSparseMatrixFromFile(
+	CountWordContextPath());
+
+    // Old contexts keep their IDs and new ones follow in order of first
+    // appearance, as if the new files came last in a single pass.
+    unordered_map<string, Context> new_context_str2num;
+    unordered_map<Context, string> new_context_num2str;
+    new_context_str2num.swap(context_str2num_);
+    new_context_num2str.swap(context_num2str_);
+    context_str2num_ = old_context_str2num;
+    context_num2str_ = old_context_num2str;
+    vector<Context> merged_context(new_context_num2str.size());
+    for (Context context = 0; context < merged_context.size(); ++context) {
+	const string &context_string = new_context_num2str[context];
+	auto context_pair = context_str2num_.find(context_string);
+	if (context_pair == context_str2num_.end()) {
+	    Context merged = context_num2str_.size();
+	    context_str2num_[context_string] = merged;
+	    context_num2str_[merged] = context_string;
+	    merged_context[context] = merged;
+	} else {
+	    merged_context[context] = context_pair->second;
+	}
+    }
+
+    // Under rare cutoff 0, every old word is still in the dictionary.
+    vector<Word> merged_word(old_word_num2str.size());
+    for (Word word = 0; word < merged_word.size(); ++word) {
+	auto word_pair = word_str2num_.find(old_word_num2str.at(word));
+	ASSERT(word_pair != word_str2num_.end(), "Word lost in appending: "
+	       << old_word_num2str.at(word));
+	merged_word[word] = word_pair->second;
+    }
+
+    CountShard counts;
+    for (long column = 0; column < old_counts->cols; ++column) {
+	for (long i = old_counts->pointr[column];
+	     i < old_counts->pointr[column + 1]; ++i) {
+	    counts.count_word_context.Add(
+		column, merged_word[old_counts->rowind[i]],
+		llround(old_counts->value[i]));
+	}
+    }
+    for (long column = 0; column < new_counts->cols; ++column) {
+	for (long i = new_counts->pointr[column];
+	     i < new_counts->pointr[column + 1]; ++i) {
+	    counts.count_word_context.Add(
+		merged_context[column], new_counts->rowind[i],
+		llround(new_counts->value[i]));
+	}
+    }
+    svdFreeSMat(new_counts);
+    WriteCounts(&counts);
+}
+
+void WordRep::RemoveDerivedFiles(bool counts) {
+    string signature = Signature(1);
+    vector<string> file_names;
+    FileManipulator file_manipulator;
+    file_manipulator.ListFiles(output_directory_, &file_names);
+    for (const string &file_path : file_names) {
+	string file_name = file_path.substr(output_directory_.size() + 1);
+	bool remove_file = false;
+	for (const char *prefix : {"context_str2num_", "count_word_context_",
+		    "count_word_", "count_context_"}) {
+	    remove_file |= counts && file_name == prefix + signature;
+	}
+	for (const char *prefix : {"singular_values_", "wordvectors_",
+		    "agglomerative_"}) {
+	    string file_prefix = prefix + signature + "_";
+	    remove_file |= file_name.compare(0, file_prefix.size(),
+					     file_prefix) == 0;
+	}
+	if (remove_file) { remove(file_path.c_str()); }
+    }
+}
+
+void WordRep::ExtractWordCounts(const string &corpus_file) {
     CountWords(corpus_file);
+}
+
+void WordRep::CountCorpusShard(const string &corpus_file,
+			       const string &shard_directory) {
+    log_ << endl << "[Counting a shard]" << endl;
+    log_ << "   Shard: " << shard_directory << endl << flush;
+    ASSERT(configurations_.empty(), "Cannot count a shard with --configs");
+    FileManipulator file_manipulator;
+    ASSERT(file_manipulator.Exists(SortedWordTypesPath()), "No word counts "
+	   "to share in " << output_directory_ << ": count them first with "
+	   "--words-only");
+
+    // The shard keeps the shared word counts next to its own counts. Counts
+    // made with other word counts are out of date.
+    string word_counts = file_manipulator.Content(SortedWordTypesPath());
+    string output_directory = output_directory_;
+    log_.close();
+    SetOutputDirectory(shard_directory);
+    if (file_manipulator.Exists(SortedWordTypesPath()) &&
+	file_manipulator.Content(SortedWordTypesPath()) != word_counts) {
+	ResetOutputDirectory();
+    }
+    ofstream sorted_word_types_file(SortedWordTypesPath(), ios::out);
+    sorted_word_types_file << word_counts;
+    sorted_word_types_file.close();
+    ASSERT(sorted_word_types_file.good(), "Cannot write file: "
+	   << SortedWordTypesPath());
+
+    DetermineRareWords();
+    SlideWindow(corpus_file, false);
+    log_.close();
+    SetOutputDirectory(output_directory);
+}
+
+void WordRep::MergeCorpusShards(const vector<string> &shard_directories) {
+    log_ << endl << "[Merging shards]" << endl;
+    log_ << "   Shards: " << shard_directories.size() << endl << flush;
+    FileManipulator file_manipulator;
+    ASSERT(file_manipulator.Exists(SortedWordTypesPath()), "No word counts "
+	   "shared by the shards in " << output_directory_);
+    string word_counts = file_manipulator.Content(SortedWordTypesPath());
     DetermineRareWords();
-    SlideWindow(corpus_file);
+
+    // Contexts of hash buckets are the buckets themselves.
+    context_str2num_.clear();
+    context_num2str_.clear();
+    for (Context bucket = 0; bucket < num_context_hashed_; ++bucket) {
+	context_str2num_[to_string(bucket)] = bucket;
+	context_num2str_[bucket] = to_string(bucket);
+    }
+    CountShard counts;
+    counts.memory_budget = memory_limit_ << 20;
+    counts.run_prefix = output_directory_ + "/run_merge_";
+    SparseSVDSolver sparsesvd_solver;
+    StringManipulator string_manipulator;
+    for (const string &shard_directory : shard_directories) {
+	// Paths in the shard directory of the files of the output directory.
+	auto shard_path = [&](const string &file_path) {
+	    return shard_directory + file_path.substr(output_directory_.size());
+	};
+	ASSERT(file_manipulator.Content(shard_path(SortedWordTypesPath())) ==
+	       word_counts, "Shard counted with other word counts: "
+	       << shard_directory);
+	ASSERT(file_manipulator.Exists(shard_path(CountWordContextPath())),
+	       "No counts of signature " << Signature(1) << " in shard: "
+	       << shard_directory);
+
+	// Number the new contexts of the shard in the order of its IDs.
+	vector<string> shard_context_num2str;
+	ifstream context_str2num_file(shard_path(ContextStr2NumPath()), ios::in);
+	string line;
+	vector<string> tokens;
+	while (getline(context_str2num_file, line)) {
+	    if (line == "") { continue; }
+	    string_manipulator.Split(line, " ", &tokens);
+	    Context context = stol(tokens[1]);
+	    if (context >= shard_context_num2str.size()) {
+		shard_context_num2str.resize(context + 1);
+	    }
+	    shard_context_num2str[context] = tokens[0];
+	}
+	vector<Context> merged_context(shard_context_num2str.size());
+	for (Context context = 0; context < merged_context.size(); ++context) {
+	    const string &context_string = shard_context_num2str[context];
+	    auto context_pair = context_str2num_.find(context_string);
+	    if (context_pair == context_str2num_.end()) {
+		Context merged = context_num2str_.size();
+		context_str2num_[context_string] = merged;
+		context_num2str_[merged] = context_string;
+		merged_context[context] = merged;
+	    } else {
+		merged_context[context] = context_pair->second;
+	    }
+	}
+
+	SMat shard_counts = sparsesvd_solver.ReadSparseMatrixFromFile(
+	    shard_path(CountWordContextPath()));
+	ASSERT((size_t) shard_counts->rows == word_str2num_.size() &&
+	       (size_t) shard_counts->cols == merged_context.size(),
+	       "Shard counts of wrong dimensions: " << shard_directory);
+	for (long column = 0; column < shard_counts->cols; ++column) {
+	    for (long i = shard_counts->pointr[column];
+		 i < shard_counts->pointr[column + 1]; ++i) {
+		if (OverBudget(counts, 1)) {
+		    SpillCounts(&counts, num_threads_);
+		}
+		counts.count_word_context.Add(merged_context[column],
+					      shard_counts->rowind[i],
+					      llround(shard_counts->value[i]));
+	    }
+	}
+	svdFreeSMat(shard_counts);
+
+	// Sum the marginals of the shards (exact even if their co-occurrence
+	// counts are approximate).
+	counts.word_marginal.resize(word_str2num_.size(), 0);
+	counts.context_marginal.resize(context_num2str_.size(), 0);
+	ifstream count_word_file(shard_path(CountWordPath()), ios::in);
+	for (Word word = 0; getline(count_word_file, line); ++word) {
+	    ASSERT(word < counts.word_marginal.size(), "Too many word counts "
+		   "in shard: " << shard_directory);
+	    counts.word_marginal[word] += llround(stod(line));
+	}
+	ifstream count_context_file(shard_path(CountContextPath()), ios::in);
+	for (Context context = 0; getline(count_context_file, line);
+	     ++context) {
+	    ASSERT(context < merged_context.size(), "Too many context counts "
+		   "in shard: " << shard_directory);
+	    counts.context_marginal[merged_context[context]] +=
+		llround(stod(line));
+	}
+    }
+    log_ << "   Contexts: " << context_num2str_.size() << endl;
+    WriteCounts(&counts);
+    RemoveDerivedFiles(false);
 }
 
 void WordRep::InduceLexicalRepresentations() {
@@ -66,17 +456,17 @@ void WordRep::InduceLexicalRepresentations() {
     PerformAgglomerativeClustering(dim_);
 }
 
-void WordRep::LoadWordDictionary() {
+void WordRep::LoadWordDictionary(const string &file_path) {
     FileManipulator file_manipulator;
-    ASSERT(file_manipulator.Exists(WordStr2NumPath()), "File not found, "
-	   "read from the corpus: " << WordStr2NumPath());
+    ASSERT(file_manipulator.Exists(file_path), "File not found, "
+	   "read from the corpus: " << file_path);
 
     word_str2num_.clear();
     word_num2str_.clear();
     string line;
     vector<string> tokens;
     StringManipulator string_manipulator;
-    ifstream word_str2num_file(WordStr2NumPath(), ios::in);
+    ifstream word_str2num_file(file_path, ios::in);
     while (word_str2num_file.good()) {
 	getline(word_str2num_file, line);
 	if (line == "") { continue; }
@@ -136,56 +526,94 @@ void WordRep::CountWords(const string &corpus_file) {
     if (file_manipulator.Exists(SortedWordTypesPath())) { return; }
 
     ASSERT(window_size_ >= 2, "Window size less than 2: " << window_size_);
-    unordered_map<string, size_t> wordcount;
-    string line;
-    vector<string> tokens;
-    StringManipulator string_manipulator;
-    size_t num_words = 0;
     vector<string> file_list;
     file_manipulator.ListFiles(corpus_file, &file_list);
-    for (size_t file_num = 0; file_num < file_list.size(); ++file_num) {
-	string file_path = file_list[file_num];
-	size_t num_lines = file_manipulator.NumLines(file_path);
+    unordered_map<string, size_t> wordcount;
+    size_t num_words = 0;
+    CountWordsInFiles(file_list, &wordcount, &num_words);
+    vector<pair<string, size_t> > sorted_wordcount(wordcount.begin(),
+						   wordcount.end());
+    unordered_map<string, size_t>().swap(wordcount);
+    WriteWordCounts(corpus_file, num_words, &sorted_wordcount);
+}
+
+void WordRep::CountWordsInFiles(const vector<string> &file_list,
+				unordered_map<string, size_t> *wordcount,
+				size_t *num_words) {
+    vector<vector<CorpusSegment> > parts;
+    SplitCorpus(file_list, max(num_threads_, (size_t) 1), true, &parts);
+    vector<unordered_map<string, size_t> > wordcounts(parts.size());
+    vector<size_t> nums_words(parts.size(), 0);
+    DistinctEstimate estimate;
+    bool estimated = EstimateDistinct(file_list, false, parts.size(),
+				      &estimate);
+    if (estimated) {
+	log_ << "   Estimated word types: " << estimate.num_items << endl;
+	WarnIfOverMemory("word counts", estimate.num_items * kWordTypeBytes_ *
+			 ((parts.size() > 1) ? 2 : 1));
+	for (auto &part_wordcount : wordcounts) {
+	    part_wordcount.reserve(estimate.num_items_per_part);
+	}
+    }
+    if (parts.size() == 1) {
+	CountWordsInSegments(parts[0], verbose_, nullptr, &wordcounts[0],
+			     &nums_words[0]);
+    } else {
+	size_t num_bytes = 0;
+	for (const auto &part : parts) { num_bytes += SegmentBytes(part); }
+	ProgressReporter progress(num_bytes, kReportInterval_);
 	if (verbose_) {
-	    cerr << "Counting words in file " << file_num + 1 << "/"
-		 << file_list.size() << " " << flush;
-	}
-	ifstream file(file_path, ios::in);
-	ASSERT(file.is_open(), "Cannot open file: " << file_path);
-	double line_num = 0.0;  // Float for division
-	double portion_marker = kReportInterval_;
-	while (file.good()) {
-	    getline(file, line);
-	    ++line_num;
-	    if (line == "") { continue; }
-	    string_manipulator.Split(line, " ", &tokens);
-	    if (tokens.size() > kMaxSentenceLength_) { continue; }
-	    for (const string &token : tokens) {
-		if (SkipThisString(token)) { continue; }
-		AddWordIfUnknown(token);
-		++wordcount[token];
-		++num_words;
-	    }
-	    if (verbose_ && (line_num / num_lines >= portion_marker)) {
-		portion_marker += kReportInterval_;
-		cerr << "." << flush;
-	    }
+	    progress.StartLine("Counting words with " +
+			       to_string(parts.size()) + " threads");
+	}
+	vector<thread> workers;
+	for (size_t part_num = 0; part_num < parts.size(); ++part_num) {
+	    workers.push_back(thread(&WordRep::CountWordsInSegments, this,
+				     cref(parts[part_num]), false,
+				     (verbose_) ? &progress : nullptr,
+				     &wordcounts[part_num],
+				     &nums_words[part_num]));
+	}
+	for (thread &worker : workers) { worker.join(); }
+	if (verbose_) { progress.EndLine(""); }
+    }
+
+    // Merge the counts into the largest map (unless given counts to add to).
+    size_t largest = 0;
+    for (size_t part_num = 0; part_num < parts.size(); ++part_num) {
+	if (wordcounts[part_num].size() > wordcounts[largest].size()) {
+	    largest = part_num;
 	}
-	if (verbose_) { cerr << " " << wordcount.size() << " types" << endl; }
     }
+    if (wordcount->empty()) { wordcount->swap(wordcounts[largest]); }
+    if (estimated) { wordcount->reserve(estimate.num_items); }
+    for (size_t part_num = 0; part_num < parts.size(); ++part_num) {
+	*num_words += nums_words[part_num];
+	for (const auto &word_pair : wordcounts[part_num]) {
+	    (*wordcount)[word_pair.first] += word_pair.second;
+	}
+	unordered_map<string, size_t>().swap(wordcounts[part_num]);
+    }
+}
+
+void WordRep::WriteWordCounts(const string &corpus_file, size_t num_words,
+			      vector<pair<string, size_t> > *sorted_wordcount) {
     ASSERT(num_words >= window_size_, "Number of words in the corpus smaller "
 	   "than the window size: " << num_words << " < " << window_size_);
 
-    // Sort word types in decreasing frequency.
-    vector<pair<string, size_t> > sorted_wordcount(wordcount.begin(),
-						   wordcount.end());
-    sort(sorted_wordcount.begin(), sorted_wordcount.end(),
-	 sort_pairs_second<string, size_t, greater<size_t> >());
+    // Sort word types in decreasing frequency (ties in string order, so that
+    // the result does not depend on the number of threads).
+    parallel_sort(sorted_wordcount->begin(), sorted_wordcount->end(),
+		  [](const pair<string, size_t> &left,
+		     const pair<string, size_t> &right) {
+		      return (left.second != right.second) ?
+			  left.second > right.second : left.first < right.first;
+		  }, max(num_threads_, (size_t) 1));
 
     ofstream sorted_word_types_file(SortedWordTypesPath(), ios::out);
-    for (size_t i = 0; i < sorted_wordcount.size(); ++i) {
-	string word_string = sorted_wordcount[i].first;
-	size_t word_frequency = sorted_wordcount[i].second;
+    for (size_t i = 0; i < sorted_wordcount->size(); ++i) {
+	string word_string = (*sorted_wordcount)[i].first;
+	size_t word_frequency = (*sorted_wordcount)[i].second;
 	sorted_word_types_file << word_string << " " << word_frequency << endl;
     }
 
@@ -193,7 +621,53 @@ void WordRep::CountWords(const string &corpus_file) {
     ofstream corpus_info_file(CorpusInfoPath(), ios::out);
     corpus_info_file << "Path: " << corpus_file << endl;
     corpus_info_file << num_words << " words" << endl;
-    corpus_info_file << sorted_wordcount.size() << " word types" << endl;
+    corpus_info_file << sorted_wordcount->size() << " word types" << endl;
+}
+
+void WordRep::CountWordsInSegments(const vector<CorpusSegment> &segments,
+				   bool report_progress,
+				   ProgressReporter *shared_progress,
+				   unordered_map<string, size_t> *wordcount,
+				   size_t *num_words) {
+    StringManipulator string_manipulator;
+    StringPiece line;
+    bool line_end;
+    vector<StringPiece> tokens;
+    string token;  // Reused so that known tokens do not allocate.
+    ProgressReporter progress(SegmentBytes(segments), kReportInterval_);
+    if (shared_progress != nullptr) { progress.ShareWith(shared_progress); }
+    size_t num_bytes_done = 0;
+    for (size_t segment_num = 0; segment_num < segments.size();
+	 ++segment_num) {
+	const CorpusSegment &segment = segments[segment_num];
+	if (report_progress) {
+	    progress.StartLine("Counting words in file " +
+			       to_string(segment_num + 1) + "/" +
+			       to_string(segments.size()));
+	}
+	CorpusReader reader(segment.file_path, segment.begin, segment.end);
+	while (reader.NextPiece(PieceSize(), &line, &line_end)) {
+	    if (report_progress || shared_progress != nullptr) {
+		progress.Update(num_bytes_done + reader.position() -
+				segment.begin, *num_words);
+	    }
+	    if (line.size == 0) { continue; }
+	    string_manipulator.Split(line, ' ', &tokens);
+	    for (const StringPiece &token_piece : tokens) {
+		token.assign(token_piece.data, token_piece.size);
+		if (SkipThisString(token)) { continue; }
+		++(*wordcount)[token];
+		++(*num_words);
+	    }
+	}
+	num_bytes_done += reader.position() - segment.begin;
+	if (report_progress) {
+	    progress.EndLine(" " + to_string(wordcount->size()) + " types");
+	}
+    }
+    if (shared_progress != nullptr) {
+	progress.Report(num_bytes_done, *num_words);
+    }
 }
 
 Word WordRep::AddWordIfUnknown(const string &word_string) {
@@ -274,7 +748,49 @@ void WordRep::DetermineRareWords() {
     }
 }
 
-void WordRep::SlideWindow(const string &corpus_file) {
+void WordRep::SlideWindows(const string &corpus_file) {
+    StringManipulator string_manipulator;
+    vector<string> configuration_strings;
+    string_manipulator.Split(configurations_, ",", &configuration_strings);
+    vector<pair<size_t, string> > configurations;
+    configurations.push_back(make_pair(window_size_, context_definition_));
+    for (const string &configuration_string : configuration_strings) {
+	vector<string> fields;
+	string_manipulator.Split(configuration_string, ":", &fields);
+	ASSERT(fields.size() == 2 &&
+	       fields[0].find_first_not_of("0123456789") == string::npos,
+	       "Configuration not window:context: " << configuration_string);
+	ASSERT(stol(fields[0]) >= 2, "Window size less than 2: " << fields[0]);
+	configurations.push_back(make_pair(stol(fields[0]), fields[1]));
+    }
+
+    // The token ID file is written by the first configuration and read by
+    // all. It is kept only if it is wanted as a cache.
+    bool cache_tokens = cache_tokens_;
+    size_t window_size = window_size_;
+    string context_definition = context_definition_;
+    cache_tokens_ = true;
+    for (const auto &configuration : configurations) {
+	window_size_ = configuration.first;
+	context_definition_ = configuration.second;
+	DetermineRareWords();  // SlideWindow clears the word dictionary.
+	SlideWindow(corpus_file, false);
+    }
+    if (!cache_tokens) { remove(TokenIdsPath().c_str()); }
+    cache_tokens_ = cache_tokens;
+    window_size_ = window_size;
+    context_definition_ = context_definition;
+}
+
+void WordRep::SlideWindow(const string &corpus_file, bool count_words) {
+    FileManipulator file_manipulator;
+    vector<string> file_list;
+    file_manipulator.ListFiles(corpus_file, &file_list);
+    SlideWindow(corpus_file, file_list, count_words);
+}
+
+void WordRep::SlideWindow(const string &corpus_file,
+			  const vector<string> &file_list, bool count_words) {
     string corpus_format = (sentence_per_line_) ? "1 line = 1 sentence" :
 	"Whole Text = 1 sentence";
     log_ << endl << "[Sliding window]" << endl;
@@ -284,90 +800,255 @@ void WordRep::SlideWindow(const string &corpus_file) {
 
     // If we already have count files, do not repeat the work.
     FileManipulator file_manipulator;
-    if (file_manipulator.Exists(ContextStr2NumPath()) &&
+    if (!count_words &&
+	file_manipulator.Exists(ContextStr2NumPath()) &&
 	file_manipulator.Exists(CountWordContextPath()) &&
 	file_manipulator.Exists(CountWordPath()) &&
 	file_manipulator.Exists(CountContextPath())) {
 	log_ << "   Counts already exist" << endl;
 	return;
     }
+    if (count_words) {
+	ASSERT(window_size_ >= 2, "Window size less than 2: " << window_size_);
+	ASSERT(sketch_memory_ == 0, "Approximate counts need the word "
+	       "dictionary in advance (no single pass)");
+	log_ << "   Single pass: counting words at the same time" << endl;
+    }
+    if (num_context_hashed_ > 0) {
+	ASSERT(num_context_hashed_ < UINT32_MAX, "Too many hash buckets: "
+	       << num_context_hashed_);
+	log_ << "   Hash buckets: " << num_context_hashed_ << endl;
+    }
 
     // Pre-compute values we need over and over again.
     size_t word_index = (window_size_ - 1) / 2;  // Right-biased
-    vector<string> position_markers(window_size_);
+    position_markers_.assign(window_size_, "");
     for (size_t context_index = 0; context_index < window_size_;
 	 ++context_index) {
 	if (context_index != word_index) {
-	    position_markers[context_index] = "w(" +
+	    position_markers_[context_index] = "w(" +
 		to_string(((int) context_index) - ((int) word_index)) + ")=";
 	}
     }
-
-    // count_word_context[j][i] = count of word i and context j coocurring
-    unordered_map<Context, unordered_map<Word, double> > count_word_context;
-
-    // Put start buffering in the window.
-    deque<string> window;
-    for (size_t buffering = 0; buffering < word_index; ++buffering) {
-	window.push_back(kBufferString_);
+    context_type_ = GetContextType();
+    process_window_ = ChooseWindowProcessor(context_type_);
+    if (!count_words) { SetWindowWords(); }
+    keep_probability_.clear();
+    if (subsample_threshold_ > 0.0) {
+	ASSERT(!count_words, "Subsampling needs word counts in advance (no "
+	       "single pass)");
+	SetKeepProbabilities();
     }
 
+    // Pairs of the most frequent words (the largest IDs: rarer words come
+    // first) with their bag or list contexts are counted in dense blocks.
+    head_begin_ = string::npos;
+    // Split the corpus (or its cached word IDs) into contiguous parts, one
+    // per worker.
     time_t begin_time_sliding = time(NULL);  // Window sliding time.
-    StringManipulator string_manipulator;
-    string line;
-    vector<string> tokens;
-    hash<string> context_hash;
-    vector<string> file_list;
-    file_manipulator.ListFiles(corpus_file, &file_list);
-    for (size_t file_num = 0; file_num < file_list.size(); ++file_num) {
-	string file_path = file_list[file_num];
-	size_t num_lines = file_manipulator.NumLines(file_path);
-	if (verbose_) {
-	    cerr << "Sliding window in file " << file_num + 1 << "/"
-		 << file_list.size() << " " << flush;
-	}
-	ifstream file(file_path, ios::in);
-	ASSERT(file.is_open(), "Cannot open file: " << file_path);
-	double line_num = 0.0;  // Float for division
-	double portion_marker = kReportInterval_;
-	while (file.good()) {
-	    getline(file, line);
-	    ++line_num;
-	    if (line == "") { continue; }
-	    string_manipulator.Split(line, " ", &tokens);
-	    if (tokens.size() > kMaxSentenceLength_) { continue; }
-	    for (const string &token : tokens) {
-		if (SkipThisString(token)) { continue; }
-		string new_string =
-		    (word_str2num_.find(token) != word_str2num_.end()) ?
-		    token : kRareString_;
-		window.push_back(new_string);
-		if (window.size() >= window_size_) {  // Full window.
-		    ProcessWindow(window, word_index, position_markers,
-				  context_hash, &count_word_context);
-		    window.pop_front();
-		}
+    size_t num_parts = max(num_threads_, (size_t) 1);
+    vector<vector<CorpusSegment> > parts;
+    unique_ptr<TokenIdReader> token_ids;
+    vector<pair<size_t, size_t> > id_parts;
+    if (cache_tokens_ && !count_words) {
+	size_t corpus_size = 0;
+	for (const string &file_path : file_list) {
+	    corpus_size += file_manipulator.Size(file_path);
+	}
+	if (file_manipulator.Exists(TokenIdsPath())) {
+	    token_ids.reset(new TokenIdReader(TokenIdsPath()));
+	    if (token_ids->header().vocabulary_signature !=
+		VocabularySignature() ||
+		token_ids->header().corpus_size != corpus_size) {
+		log_ << "   Token IDs out of date" << endl;
+		token_ids.reset();
 	    }
-	    if (sentence_per_line_) {
-		FinishWindow(word_index, position_markers, context_hash,
-			     &window, &count_word_context);
+	}
+	if (!token_ids) {
+	    WriteTokenIds(file_list);
+	    token_ids.reset(new TokenIdReader(TokenIdsPath()));
+	}
+	log_ << "   Token IDs: " << TokenIdsPath() << endl;
+	SplitTokenIds(token_ids->ids(), token_ids->num_ids(), num_parts,
+		      &id_parts);
+	num_parts = id_parts.size();
+    } else {
+	SplitCorpus(file_list, num_parts, sentence_per_line_, &parts);
+	num_parts = parts.size();
+    }
+
+    // Subsampling keys each token by its index in the corpus, so that the
+    // sample does not depend on the parts or on caching word IDs.
+    vector<size_t> token_offsets(num_parts, 0);
+    if (!keep_probability_.empty() && num_parts > 1) {
+	vector<size_t> nums_tokens(num_parts, 0);
+	vector<thread> workers;
+	for (size_t part_num = 0; part_num + 1 < num_parts; ++part_num) {
+	    workers.push_back(thread([&, part_num]() {
+		nums_tokens[part_num] = (token_ids) ?
+		    count_if(token_ids->ids() + id_parts[part_num].first,
+			     token_ids->ids() + id_parts[part_num].second,
+			     [](uint32_t id) {
+				 return id < TokenIdReader::kLongSentenceEnd;
+			     }) : CountTokensInSegments(parts[part_num]);
+	    }));
+	}
+	for (thread &worker : workers) { worker.join(); }
+	for (size_t part_num = 1; part_num < num_parts; ++part_num) {
+	    token_offsets[part_num] = token_offsets[part_num - 1] +
+		nums_tokens[part_num - 1];
+	}
+    }
+    auto slide_part = [&](size_t part_num, bool report_progress,
+			  ProgressReporter *shared_progress,
+			  CountShard *shard) {
+	if (head_begin_ != string::npos) {
+	    shard->head_counts.assign(
+		num_head_words_ * num_head_slots_ * num_head_words_, 0);
+	}
+	if (token_ids) {
+	    SlideWindowOverIds(token_ids->ids() + id_parts[part_num].first,
+			       id_parts[part_num].second -
+			       id_parts[part_num].first,
+			       token_offsets[part_num], word_index,
+			       report_progress, shared_progress, shard);
+	} else {
+	    SlideWindowOverSegments(parts[part_num], token_offsets[part_num],
+				    word_index, report_progress,
+				    shared_progress, shard);
+	}
+	if (!shard->head_counts.empty()) { FlushHeadCounts(shard); }
+	if (shard->sketch.initialized()) { FlushToSketch(shard); }
+    };
+    // Presize the tables of the shards to the numbers of distinct pairs and
+    // contexts estimated from a sample of the corpus.
+    DistinctEstimate estimate;
+    bool estimated = !count_words &&
+	EstimateDistinct(file_list, true, num_parts, &estimate);
+    if (estimated) {
+	log_ << "   Estimated pairs: " << estimate.num_items << " ("
+	     << estimate.num_contexts << " contexts)" << endl;
+	size_t table_bytes = (sort_counts_) ? 32 * estimate.num_items :
+	    CooccurrenceCounts::kSlotBytes *
+	    CooccurrenceCounts::NumSlots(estimate.num_items);
+	if (memory_limit_ == 0 && sketch_memory_ == 0) {
+	    WarnIfOverMemory("pair counts", table_bytes);
+	}
+    }
+    vector<CountShard> shards(num_parts);
+    for (size_t part_num = 0; part_num < num_parts; ++part_num) {
+	shards[part_num].provisional_words = count_words;
+	shards[part_num].memory_budget = (memory_limit_ << 20) / num_parts;
+	shards[part_num].run_prefix = output_directory_ + "/run" +
+	    to_string(part_num) + "_";
+	if (sketch_memory_ > 0) {
+	    // A candidate takes about 64 bytes, and up to twice the candidates
+	    // kept are held between prunings.
+	    size_t num_bytes = (sketch_memory_ << 20) / num_parts;
+	    shards[part_num].sketch.Initialize(num_bytes / 2,
+					       num_bytes / 4 / 64 / 2);
+	    shards[part_num].memory_budget = num_bytes / 4;
+	}
+	if (shards[part_num].memory_budget > 0) {  // Dense index up to 1/4
+	    shards[part_num].max_unigram_index =
+		shards[part_num].memory_budget / 4 / sizeof(Context);
+	}
+	if (sort_counts_) {  // A buffered pair takes 16 bytes with sort space.
+	    size_t memory_budget = shards[part_num].memory_budget;
+	    shards[part_num].count_word_context.UseSortAndReduce(
+		(memory_budget > 0) ? memory_budget / 8 / 16 : kSortBufferSize_);
+	}
+	if (estimated) {
+	    shards[part_num].expected_num_pairs = estimate.num_items_per_part;
+	    PresizeCounts(&shards[part_num]);
+	    if (!BucketedContexts(shards[part_num])) {
+		shards[part_num].context_recipes.reserve(
+		    estimate.num_contexts_per_part);
 	    }
-	    if (verbose_ && (line_num / num_lines >= portion_marker)) {
-		portion_marker += kReportInterval_;
-		cerr << "." << flush;
+	    if (context_type_ == kBigram || context_type_ == kSkipgram) {
+		shards[part_num].pair_context.reserve(
+		    estimate.num_contexts_per_part);
 	    }
 	}
-	if (!sentence_per_line_) {
-	    FinishWindow(word_index, position_markers, context_hash, &window,
-			 &count_word_context);
+    }
+    if (head_size_ > 0 && !count_words &&
+	(context_type_ == kBag || context_type_ == kList ||
+	 context_type_ == kBagList)) {
+	// List slots leave out the center, and the block takes up to 1/4 of
+	// the budget of a shard.
+	head_slot_offset_ = (context_type_ == kList) ? 1 : 0;
+	head_center_slot_ = (context_type_ == kBag) ? string::npos :
+	    word_index + 1;
+	num_head_slots_ = (context_type_ == kBag) ? 1 :
+	    window_size_ - head_slot_offset_;
+	num_head_words_ = min(head_size_, window_word_num2str_.size());
+	if (shards[0].memory_budget > 0) {
+	    num_head_words_ = min(num_head_words_, (size_t) sqrt(
+		shards[0].memory_budget / 4 / num_head_slots_ /
+		sizeof(uint32_t)));
+	}
+	if (num_head_words_ > 0) {
+	    head_begin_ = window_word_num2str_.size() - num_head_words_;
+	    log_ << "   Head block: " << num_head_words_ << " words ("
+		 << (num_head_words_ * num_head_words_ * num_head_slots_ *
+		     sizeof(uint32_t) >> 20) << " MB per thread)" << endl;
 	}
-	if (verbose_) { cerr << endl; }
+    }
+    if (num_parts == 1) {
+	slide_part(0, verbose_, nullptr, &shards[0]);
+    } else {
+	log_ << "   Threads: " << num_parts << endl;
+	size_t num_units = 0;  // Word IDs or bytes
+	for (size_t part_num = 0; part_num < num_parts; ++part_num) {
+	    num_units += (token_ids) ?
+		id_parts[part_num].second - id_parts[part_num].first :
+		SegmentBytes(parts[part_num]);
+	}
+	ProgressReporter progress(num_units, kReportInterval_);
+	if (verbose_) {
+	    progress.StartLine("Sliding window with " + to_string(num_parts) +
+			       " threads");
+	}
+	vector<thread> workers;
+	for (size_t part_num = 0; part_num < num_parts; ++part_num) {
+	    workers.push_back(thread(slide_part, part_num, false,
+				     (verbose_) ? &progress : nullptr,
+				     &shards[part_num]));
+	}
+	for (thread &worker : workers) { worker.join(); }
+	if (verbose_) { progress.EndLine(""); }
+    }
+    token_ids.reset();
+    if (sketch_memory_ == 0) {  // Workers are done.
+	shards[0].memory_budget = memory_limit_ << 20;
+	if (estimated && num_parts > 1) {  // Make room for the other shards.
+	    shards[0].expected_num_pairs = estimate.num_items;
+	    PresizeCounts(&shards[0]);
+	}
+    }
+    MergeCountShards(&shards);
+
+    // Fold rare words if they were not known in advance.
+    CountShard *counts = &shards[0];
+    if (count_words) { FoldRareWords(corpus_file, counts); }
+    context_str2num_.clear();
+    context_num2str_.clear();
+    for (Context context = 0; context < NumContexts(*counts); ++context) {
+	string context_string = (BucketedContexts(*counts)) ?
+	    to_string(context) :
+	    ContextString(counts->context_recipes[context], *counts);
+	context_str2num_[context_string] = context;
+	context_num2str_[context] = context_string;
     }
 
     double time_sliding = difftime(time(NULL), begin_time_sliding);
+    StringManipulator string_manipulator;
     log_ << "   Time taken: " << string_manipulator.TimeString(time_sliding)
 	 << endl;
+    WriteCounts(counts);
+}
 
+void WordRep::WriteCounts(CountShard *counts) {
     // Write the filtered context dictionary.
     if (verbose_) { cerr << "Writing counts" << endl; }
     ofstream context_str2num_file(ContextStr2NumPath(), ios::out);
@@ -377,24 +1058,52 @@ void WordRep::SlideWindow(const string &corpus_file) {
     }
 
     // Write counts to the output directory.
-    SparseSVDSolver sparsesvd_solver;  // Write as a sparse matrix for SVDLIBC.
-    size_t num_nonzeros = 0;
-    for (const auto &context_pair : count_word_context) {
-	num_nonzeros += context_pair.second.size();
-    }
-    unordered_map<Word, double> count_word;  // i-th: count of word i
-    unordered_map<Context, double> count_context;  // j-th: count of context j
-    sparsesvd_solver.WriteSparseMatrix(count_word_context,
-				       CountWordContextPath(),
-				       word_str2num_.size(),
-				       context_str2num_.size(), num_nonzeros,
-				       &count_word, &count_context);
+    // count_word_context[j][i] = count of word i and context j coocurring
+    vector<double> count_word;  // i-th: count of word i
+    vector<double> count_context;  // j-th: count of context j
+    if (counts->run_paths.empty()) {
+	SparseSVDSolver sparsesvd_solver;  // Write as a sparse matrix.
+	SMat count_word_context = counts->count_word_context.ToSparseMatrix(
+	    word_str2num_.size(), context_str2num_.size(), num_threads_);
+	sparsesvd_solver.WriteSparseMatrix(count_word_context,
+					   CountWordContextPath(),
+					   &count_word, &count_context);
+	svdFreeSMat(count_word_context);
+    } else {  // Merge the counts spilled to disk.
+	if (counts->count_word_context.size() > 0) {
+	    SpillCounts(counts, num_threads_);
+	}
+	log_ << "   Merging " << counts->run_paths.size() << " spilled runs"
+	     << endl;
+	CooccurrenceCounts::MergeRuns(counts->run_paths, word_str2num_.size(),
+				      context_str2num_.size(),
+				      CountWordContextPath(), &count_word,
+				      &count_context);
+	for (const string &run_path : counts->run_paths) {
+	    remove(run_path.c_str());
+	}
+    }
+
+    if (!counts->context_marginal.empty()) {  // Exact marginals
+	count_word.assign(word_str2num_.size(), 0.0);
+	for (Word word = 0; word < count_word.size() &&
+		 word < counts->word_marginal.size(); ++word) {
+	    count_word[word] = counts->word_marginal[word];
+	}
+	count_context.assign(context_str2num_.size(), 0.0);
+	for (Context context = 0; context < count_context.size() &&
+		 context < counts->context_marginal.size(); ++context) {
+	    count_context[context] = counts->context_marginal[context];
+	}
+    }
 
     ofstream count_word_file(CountWordPath(), ios::out);
+    count_word_file << setprecision(numeric_limits<double>::max_digits10);
     for (Word word = 0; word < count_word.size(); ++word) {
 	count_word_file << count_word[word] << endl;
     }
     ofstream count_context_file(CountContextPath(), ios::out);
+    count_context_file << setprecision(numeric_limits<double>::max_digits10);
     for (Context context = 0; context < count_context.size(); ++context) {
 	count_context_file << count_context[context] << endl;
     }
@@ -404,111 +1113,1303 @@ void WordRep::SlideWindow(const string &corpus_file) {
     context_num2str_.clear();
 }
 
-void WordRep::FinishWindow(size_t word_index,
-			   const vector<string> &position_markers,
-			   const hash<string> &context_hash,
-			   deque<string> *window,
-			   unordered_map<Context, unordered_map<Word, double> >
-			   *count_word_context) {
+void WordRep::DeriveCounts(size_t list_window_size) {
+    log_ << endl << "[Deriving counts]" << endl;
+    log_ << "   Window size: " << window_size_ << endl;
+    log_ << "   Context definition: " << context_definition_ << endl;
+    log_ << "   From list counts with window size: " << list_window_size
+	 << endl << flush;
+    ASSERT(context_definition_ == "bag" || context_definition_ == "list" ||
+	   context_definition_ == "baglist", "Cannot derive counts of "
+	   "context definition: " << context_definition_);
+    ASSERT(num_context_hashed_ == 0, "Cannot derive counts of hashed "
+	   "contexts");
+
+    // Offsets of the window relative to the center word (right-biased) must
+    // be within those of the list window.
+    int min_offset = -(int) ((window_size_ - 1) / 2);
+    int max_offset = min_offset + (int) window_size_ - 1;
+    int list_min_offset = -(int) ((list_window_size - 1) / 2);
+    int list_max_offset = list_min_offset + (int) list_window_size - 1;
+    ASSERT(window_size_ >= 2 && min_offset >= list_min_offset &&
+	   max_offset <= list_max_offset, "Window size " << window_size_
+	   << " does not fit in window size " << list_window_size);
+
+    // If we already have count files, do not repeat the work.
+    FileManipulator file_manipulator;
+    if (file_manipulator.Exists(ContextStr2NumPath()) &&
+	file_manipulator.Exists(CountWordContextPath()) &&
+	file_manipulator.Exists(CountWordPath()) &&
+	file_manipulator.Exists(CountContextPath())) {
+	log_ << "   Counts already exist" << endl;
+	return;
+    }
+
+    // Load the list contexts and their counts.
+    size_t window_size = window_size_;
+    string context_definition = context_definition_;
+    window_size_ = list_window_size;
+    context_definition_ = "list";
+    ASSERT(file_manipulator.Exists(CountWordContextPath()), "File not found, "
+	   "count list contexts first: " << CountWordContextPath());
+    LoadContextDictionary();
+    SparseSVDSolver sparsesvd_solver;
+    SMat list_counts = sparsesvd_solver.ReadSparseMatrixFromFile(
+	CountWordContextPath());
+    window_size_ = window_size;
+    context_definition_ = context_definition;
+
+    // A context of a sliding window gets its ID when first seen. A list
+    // context is first seen exactly when it is first seen in the list window,
+    // and a bag context when the first of its list contexts is (right before
+    // the list context for "baglist"). Sorting by these times gives the IDs.
+    vector<Context> list_context(context_num2str_.size(), string::npos);
+    vector<Context> bag_context(context_num2str_.size(), string::npos);
+    unordered_map<string, size_t> bag_first_seen;
+    vector<tuple<size_t, bool, string> > first_seen;  // (time, list?, string)
+    for (Context context = 0; context < context_num2str_.size(); ++context) {
+	const string &context_string = context_num2str_[context];
+	size_t marker_end = context_string.find(")=");
+	ASSERT(context_string.substr(0, 2) == "w(" &&
+	       marker_end != string::npos, "Not a list context: "
+	       << context_string);
+	int offset = stoi(context_string.substr(2, marker_end - 2));
+	if (offset < min_offset || offset > max_offset) { continue; }
+	if (context_definition_ != "bag") {
+	    list_context[context] = first_seen.size();  // Order for now
+	    first_seen.push_back(make_tuple(context, true, context_string));
+	}
+	if (context_definition_ != "list") {
+	    string word_string = context_string.substr(marker_end + 2);
+	    if (bag_first_seen.find(word_string) == bag_first_seen.end()) {
+		bag_first_seen[word_string] = first_seen.size();
+		first_seen.push_back(make_tuple(context, false, word_string));
+	    }
+	    bag_context[context] = bag_first_seen[word_string];
+	}
+    }
+    vector<size_t> order(first_seen.size());
+    for (size_t i = 0; i < order.size(); ++i) { order[i] = i; }
+    sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+	    return make_pair(get<0>(first_seen[i]), get<1>(first_seen[i])) <
+		make_pair(get<0>(first_seen[j]), get<1>(first_seen[j]));
+	});
+    vector<Context> derived_context(order.size());
+    context_str2num_.clear();
+    context_num2str_.clear();
+    for (Context context = 0; context < order.size(); ++context) {
+	derived_context[order[context]] = context;
+	context_str2num_[get<2>(first_seen[order[context]])] = context;
+	context_num2str_[context] = get<2>(first_seen[order[context]]);
+    }
+
+    // Add up the counts of the list contexts in each derived context.
+    CountShard counts;
+    for (long column = 0; column < list_counts->cols; ++column) {
+	for (long i = list_counts->pointr[column];
+	     i < list_counts->pointr[column + 1]; ++i) {
+	    Word word = list_counts->rowind[i];
+	    uint64_t count = llround(list_counts->value[i]);
+	    if (list_context[column] != string::npos) {
+		counts.count_word_context.Add(
+		    derived_context[list_context[column]], word, count);
+	    }
+	    if (bag_context[column] != string::npos) {
+		counts.count_word_context.Add(
+		    derived_context[bag_context[column]], word, count);
+	    }
+	}
+    }
+    svdFreeSMat(list_counts);
+    LoadWordDictionary();
+    WriteCounts(&counts);
+}
+
+void WordRep::RebucketCounts(size_t source_rare_cutoff) {
+    log_ << endl << "[Re-bucketing counts]" << endl;
+    log_ << "   From rare cutoff: " << source_rare_cutoff << endl << flush;
+    ASSERT(source_rare_cutoff < rare_cutoff_, "Cannot re-bucket counts of "
+	   "rare cutoff " << source_rare_cutoff << " to " << rare_cutoff_);
+    ASSERT(num_context_hashed_ == 0, "Cannot re-bucket counts of hashed "
+	   "contexts");
+
+    // If we already have count files, do not repeat the work.
+    FileManipulator file_manipulator;
+    if (file_manipulator.Exists(ContextStr2NumPath()) &&
+	file_manipulator.Exists(CountWordContextPath()) &&
+	file_manipulator.Exists(CountWordPath()) &&
+	file_manipulator.Exists(CountContextPath())) {
+	log_ << "   Counts already exist" << endl;
+	return;
+    }
+
+    // Load the dictionaries and counts of the smaller cutoff.
+    size_t rare_cutoff = rare_cutoff_;
+    rare_cutoff_ = source_rare_cutoff;
+    ASSERT(file_manipulator.Exists(CountWordContextPath()), "File not found, "
+	   "count with the smaller cutoff first: " << CountWordContextPath());
+    LoadWordDictionary();
+    LoadContextDictionary();
+    SparseSVDSolver sparsesvd_solver;
+    SMat source_counts = sparsesvd_solver.ReadSparseMatrixFromFile(
+	CountWordContextPath());
+    unordered_map<Word, string> source_word_num2str;
+    unordered_map<Context, string> source_context_num2str;
+    source_word_num2str.swap(word_num2str_);
+    source_context_num2str.swap(context_num2str_);
+    rare_cutoff_ = rare_cutoff;
+    DetermineRareWords();
+
+    // Words that are rare only under the larger cutoff are folded into the
+    // rare symbol. A folded context is first seen when the first of its
+    // contexts is, so going through them in order of ID gives the IDs.
+    vector<Word> folded_word(source_word_num2str.size());
+    for (Word word = 0; word < folded_word.size(); ++word) {
+	auto word_pair = word_str2num_.find(source_word_num2str[word]);
+	folded_word[word] = (word_pair != word_str2num_.end()) ?
+	    word_pair->second : word_str2num_[kRareString_];
+    }
+    vector<Context> folded_context(source_context_num2str.size());
+    context_str2num_.clear();
+    context_num2str_.clear();
+    for (Context context = 0; context < folded_context.size(); ++context) {
+	string context_string =
+	    FoldContextString(source_context_num2str[context]);
+	auto context_pair = context_str2num_.find(context_string);
+	if (context_pair == context_str2num_.end()) {
+	    Context new_context = context_num2str_.size();
+	    context_str2num_[context_string] = new_context;
+	    context_num2str_[new_context] = context_string;
+	    folded_context[context] = new_context;
+	} else {
+	    folded_context[context] = context_pair->second;
+	}
+    }
+
+    // Add up the counts of the folded words and contexts.
+    CountShard counts;
+    for (long column = 0; column < source_counts->cols; ++column) {
+	for (long i = source_counts->pointr[column];
+	     i < source_counts->pointr[column + 1]; ++i) {
+	    counts.count_word_context.Add(
+		folded_context[column], folded_word[source_counts->rowind[i]],
+		llround(source_counts->value[i]));
+	}
+    }
+    svdFreeSMat(source_counts);
+    WriteCounts(&counts);
+}
+
+string WordRep::FoldContextString(const string &context_string) {
+    auto fold = [&](const string &word_string) {
+	return (word_string == kBufferString_ ||
+		word_str2num_.find(word_string) != word_str2num_.end()) ?
+	    word_string : kRareString_;
+    };
+    size_t marker_end = context_string.find(")=");
+    if ((context_definition_ == "list" || context_definition_ == "baglist") &&
+	context_string.substr(0, 2) == "w(" && marker_end != string::npos) {
+	return context_string.substr(0, marker_end + 2) +
+	    fold(context_string.substr(marker_end + 2));  // List
+    }
+    size_t glue = context_string.find(kNGramGlueString_);
+    if ((context_definition_ == "bigram" || context_definition_ == "skipgram")
+	&& glue != string::npos) {  // N-gram
+	return ContextString(string::npos, fold(context_string.substr(0, glue)),
+			     fold(context_string.substr(
+				      glue + kNGramGlueString_.size())));
+    }
+    return fold(context_string);  // Bag
+}
+
+void WordRep::SplitCorpus(const vector<string> &file_list, size_t num_parts,
+			  bool split_files,
+			  vector<vector<CorpusSegment> > *parts) {
+    FileManipulator file_manipulator;
+    vector<size_t> file_sizes;
+    size_t total_size = 0;
+    for (const string &file_path : file_list) {
+	file_sizes.push_back(file_manipulator.Size(file_path));
+	total_size += file_sizes.back();
+    }
+    size_t part_size = max(total_size / num_parts, (size_t) 1);
+
+    // Part k ends near byte k * part_size of the concatenated files, moved
+    // forward to the next line start (or to the end of the file).
+    // Streamed files are not split (their compressed sizes serve as weights).
+    parts->assign(1, vector<CorpusSegment>());
+    size_t offset = 0;  // Total size of the files before the current file.
+    for (size_t file_num = 0; file_num < file_list.size(); ++file_num) {
+	const string &file_path = file_list[file_num];
+	size_t file_size = file_sizes[file_num];
+	bool streamed = StreamedFile::IsStream(file_path);
+	size_t begin = 0;
+	unique_ptr<MappedFile> file;  // Mapped at the first cut
+	while (split_files && !streamed && parts->size() < num_parts &&
+	       parts->size() * part_size < offset + file_size) {
+	    size_t cut = parts->size() * part_size - offset;
+	    if (cut > begin) {
+		if (!file) { file.reset(new MappedFile(file_path)); }
+		const char *newline = (const char *) memchr(
+		    file->data() + cut - 1, '\n', file_size - cut + 1);
+		cut = (newline != nullptr) ? newline + 1 - file->data() :
+		    file_size;  // Skip to the next line start.
+		parts->back().push_back({file_path, begin, cut});
+		begin = cut;
+	    }
+	    parts->resize(parts->size() + 1);
+	}
+	if (begin < file_size || streamed) {
+	    parts->back().push_back({file_path, begin, file_size});
+	}
+	offset += file_size;
+	if ((!split_files || streamed) && parts->size() < num_parts &&
+	    offset >= parts->size() * part_size) {
+	    parts->resize(parts->size() + 1);
+	}
+    }
+
+    // Drop empty parts (e.g., a single line spanning several parts).
+    vector<vector<CorpusSegment> > nonempty_parts;
+    for (vector<CorpusSegment> &part : *parts) {
+	if (!part.empty()) { nonempty_parts.push_back(part); }
+    }
+    if (nonempty_parts.empty()) { nonempty_parts.resize(1); }
+    parts->swap(nonempty_parts);
+}
+
+bool WordRep::EstimateDistinct(const vector<string> &file_list, bool pairs,
+			       size_t num_parts, DistinctEstimate *estimate) {
+    FileManipulator file_manipulator;
+    size_t corpus_size = 0;
+    for (const string &file_path : file_list) {
+	if (StreamedFile::IsStream(file_path)) { return false; }
+	corpus_size += file_manipulator.Size(file_path);
+    }
+    if (corpus_size == 0) { return false; }
+
+    // Read the beginning of each part of the corpus split into samples.
+    vector<vector<CorpusSegment> > samples;
+    SplitCorpus(file_list, kNumSamples_, true, &samples);
+    size_t sample_size = kSampleBytes_ / kNumSamples_;
+    HyperLogLog item_counter;
+    HyperLogLog context_counter;
+    HyperLogLog half_item_counter;  // Over the first half of the samples
+    HyperLogLog half_context_counter;
+    size_t num_bytes = 0;
+    size_t num_half_bytes = 0;
+    size_t num_tokens = 0;
+    StringManipulator string_manipulator;
+    StringPiece line;
+    bool line_end;
+    vector<StringPiece> tokens;
+    string token;
+    WordWindow window(window_size_);
+    for (size_t sample_num = 0; sample_num < samples.size(); ++sample_num) {
+	if (sample_num > 0 && sample_num == samples.size() / 2) {
+	    half_item_counter = item_counter;
+	    half_context_counter = context_counter;
+	    num_half_bytes = num_bytes;
+	}
+	const CorpusSegment &segment = samples[sample_num][0];
+	CorpusReader reader(segment.file_path, segment.begin, segment.end);
+	window.clear();
+	while (reader.position() - segment.begin < sample_size &&
+	       reader.NextPiece(PieceSize(), &line, &line_end)) {
+	    if (line.size == 0) { continue; }
+	    string_manipulator.Split(line, ' ', &tokens);
+	    if (pairs && sentence_per_line_ &&
+		tokens.size() > kMaxSentenceLength_) {
+		continue;
+	    }
+	    for (const StringPiece &token_piece : tokens) {
+		token.assign(token_piece.data, token_piece.size);
+		if (SkipThisString(token)) { continue; }
+		++num_tokens;
+		if (!pairs) {
+		    item_counter.Add(hash<string>()(token));
+		    continue;
+		}
+		auto word_pair = word_str2num_.find(token);
+		Word word = (word_pair != word_str2num_.end()) ?
+		    word_pair->second : rare_word_;
+		if (word == string::npos) { continue; }
+		window.push_back(word);
+		if (window.size() == window_size_) {
+		    SamplePairs(window, &item_counter, &context_counter);
+		    window.pop_front();
+		}
+	    }
+	    if (sentence_per_line_) { window.clear(); }
+	}
+	num_bytes += reader.position() - segment.begin;
+    }
+
+    // Project the numbers of distinct items in the samples, at most the
+    // number of items that the projected tokens can make (up to the square
+    // of the window size per token if pairs).
+    auto project = [&](const HyperLogLog &counter,
+		       const HyperLogLog &half_counter, double num_parts) {
+	double num_distinct = counter.Estimate();
+	double scale = (double) corpus_size / num_bytes / num_parts;
+	double exponent = 1.0;  // Linear growth if it cannot be fitted.
+	if (num_half_bytes > 0 && half_counter.Estimate() > 0.0) {
+	    exponent = log(num_distinct / half_counter.Estimate()) /
+		log((double) num_bytes / num_half_bytes);
+	    exponent = min(max(exponent, 0.0), 1.0);
+	}
+	double max_items = num_tokens * scale *
+	    ((pairs) ? window_size_ * window_size_ : 1);
+	return (size_t) min(num_distinct * pow(scale, exponent), max_items);
+    };
+    estimate->num_items = project(item_counter, half_item_counter, 1);
+    estimate->num_items_per_part = project(item_counter, half_item_counter,
+					   num_parts);
+    estimate->num_contexts = project(context_counter, half_context_counter, 1);
+    estimate->num_contexts_per_part = project(context_counter,
+					      half_context_counter, num_parts);
+    if (num_context_hashed_ > 0) {  // Contexts are buckets.
+	estimate->num_contexts = min(estimate->num_contexts,
+				     num_context_hashed_);
+	estimate->num_contexts_per_part = min(estimate->num_contexts_per_part,
+					      num_context_hashed_);
+	if (pairs) {
+	    size_t num_pairs = num_context_hashed_ *
+		window_word_num2str_.size();
+	    estimate->num_items = min(estimate->num_items, num_pairs);
+	    estimate->num_items_per_part = min(estimate->num_items_per_part,
+					       num_pairs);
+	}
+    }
+    return true;
+}
+
+void WordRep::SamplePairs(const WordWindow &window, HyperLogLog *pair_counter,
+			  HyperLogLog *context_counter) {
+    // Keys of contexts as in CountShard: bag and list contexts by their word
+    // and slot, pair contexts by their words.
+    const Word *words = window.data();
+    size_t word_index = (window_size_ - 1) / 2;
+    Word word = words[word_index];
+    auto add = [&](uint64_t context_key) {
+	context_counter->Add(context_key);
+	pair_counter->Add(MixBits(context_key) ^ word);
+    };
+    const uint64_t kPairTag = 0x9e3779b97f4a7c15ULL;  // Apart from unigrams
+    for (size_t context_index = 0; context_index < window_size_;
+	 ++context_index) {
+	if (context_index == word_index) { continue; }
+	Word context_word = words[context_index];
+	uint64_t unigram_key = context_word * (window_size_ + 1);
+	if (context_type_ == kBag || context_type_ == kBagList) {
+	    add(unigram_key);
+	}
+	if (context_type_ == kList || context_type_ == kBagList) {
+	    add(unigram_key + context_index + 1);
+	}
+	if (context_type_ == kBigram && context_index < window_size_ - 1 &&
+	    context_index != word_index - 1) {
+	    add(((uint64_t) context_word << 32 | words[context_index + 1]) ^
+		kPairTag);
+	}
+	if (context_type_ == kSkipgram) {
+	    for (size_t context_index2 = context_index + 1;
+		 context_index2 < window_size_; ++context_index2) {
+		if (context_index2 == word_index) { continue; }
+		Word word1 = min(context_word, words[context_index2]);
+		Word word2 = max(context_word, words[context_index2]);
+		add(((uint64_t) word1 << 32 | word2) ^ kPairTag);
+	    }
+	}
+    }
+}
+
+void WordRep::PresizeCounts(CountShard *shard) {
+    // A table fitting the budget spills instead of growing past it. Without
+    // a budget, it starts within a quarter of the available memory and grows
+    // past that only if the pairs are really there.
+    size_t slot_bytes = CooccurrenceCounts::kSlotBytes;
+    size_t num_slots = CooccurrenceCounts::NumSlots(0);
+    size_t count_budget = (shard->memory_budget > 0) ? CountBudget(*shard) :
+	AvailableMemory() / 4;
+    if (num_slots * slot_bytes > count_budget) { return; }
+    while (2 * num_slots * slot_bytes <= count_budget) { num_slots *= 2; }
+    shard->count_word_context.Reserve(min(shard->expected_num_pairs,
+					  num_slots * 7 / 10 - 1));
+}
+
+void WordRep::WarnIfOverMemory(const string &item, size_t num_bytes) {
+    size_t available_memory = AvailableMemory();
+    log_ << "   Projected memory for " << item << ": " << (num_bytes >> 20)
+	 << " MB (" << (available_memory >> 20) << " MB available)" << endl;
+    if (num_bytes > available_memory) {
+	log_ << "   Warning: projected memory exceeds available memory"
+	     << endl;
+	if (verbose_) {
+	    cerr << "Warning: " << item << " are projected to take "
+		 << (num_bytes >> 20) << " MB, more than the available "
+		 << (available_memory >> 20) << " MB" << endl;
+	}
+    }
+}
+
+size_t WordRep::SegmentBytes(const vector<CorpusSegment> &segments) {
+    size_t num_bytes = 0;
+    for (const CorpusSegment &segment : segments) {
+	if (StreamedFile::IsStream(segment.file_path)) { return 0; }
+	num_bytes += segment.end - segment.begin;
+    }
+    return num_bytes;
+}
+
+void WordRep::PushWindowWord(Word word, size_t word_index,
+			     WordWindow *window, CountShard *shard) {
+    window->push_back(word);
+    if (window->size() >= window_size_) {  // Full window.
+	(this->*process_window_)(*window, word_index, shard);
+	window->pop_front();
+    }
+    ReleaseMemory(shard, window_size_ * window_size_);  // Pairs of a window
+}
+
+void WordRep::ReleaseMemory(CountShard *shard, size_t num_new_pairs) {
+    if (OverBudget(*shard, num_new_pairs)) {
+	if (shard->sketch.initialized()) {
+	    FlushToSketch(shard);
+	} else {
+	    SpillCounts(shard, 1);
+	}
+	PresizeCounts(shard);
+    }
+}
+
+void WordRep::FlushHeadCounts(CountShard *shard) {
+    for (size_t row = 0; row < num_head_words_ * num_head_slots_; ++row) {
+	ReleaseMemory(shard, num_head_words_);
+	const uint32_t *row_counts = &shard->head_counts[row * num_head_words_];
+	Context context = string::npos;
+	for (size_t i = 0; i < num_head_words_; ++i) {
+	    if (row_counts[i] == 0) { continue; }
+	    if (context == string::npos) {  // Known since it has a count.
+		Word context_word = head_begin_ + row / num_head_slots_;
+		size_t slot = row % num_head_slots_ + head_slot_offset_;
+		if (slot >= head_center_slot_) { ++slot; }
+		context = *UnigramContext(context_word * (window_size_ + 1) +
+					  slot, shard);
+	    }
+	    shard->count_word_context.Add(context, head_begin_ + i,
+					  row_counts[i]);
+	}
+    }
+    vector<uint32_t>().swap(shard->head_counts);
+}
+
+size_t WordRep::CountTokensInSegments(const vector<CorpusSegment> &segments) {
+    StringManipulator string_manipulator;
+    StringPiece line;
+    bool line_end;
+    vector<StringPiece> tokens;
+    string token;
+    size_t num_tokens = 0;
+    for (const CorpusSegment &segment : segments) {
+	CorpusReader reader(segment.file_path, segment.begin, segment.end);
+	while (reader.NextPiece(PieceSize(), &line, &line_end)) {
+	    if (line.size == 0) { continue; }
+	    string_manipulator.Split(line, ' ', &tokens);
+	    for (const StringPiece &token_piece : tokens) {
+		token.assign(token_piece.data, token_piece.size);
+		if (!SkipThisString(token)) { ++num_tokens; }
+	    }
+	}
+    }
+    return num_tokens;
+}
+
+void WordRep::SlideWindowOverSegments(const vector<CorpusSegment> &segments,
+				      size_t token_offset, size_t word_index,
+				      bool report_progress,
+				      ProgressReporter *shared_progress,
+				      CountShard *shard) {
+    // Put start buffering in the window.
+    Word buffer_word = (shard->provisional_words) ?
+	AddProvisionalWordIfUnknown(kBufferString_, shard) : buffer_word_;
+    WordWindow window(window_size_);
+    for (size_t buffering = 0; buffering < word_index; ++buffering) {
+	window.push_back(buffer_word);
+    }
+
+    StringManipulator string_manipulator;
+    StringPiece line;
+    bool line_end;
+    vector<StringPiece> tokens;
+    string token;  // Reused so that known tokens do not allocate.
+    ProgressReporter progress(SegmentBytes(segments), kReportInterval_);
+    if (shared_progress != nullptr) { progress.ShareWith(shared_progress); }
+    size_t num_bytes_done = 0;
+    size_t num_tokens = 0;
+    uint64_t seed_key = MixBits(subsample_seed_);  // Keyed by token index
+    size_t token_index = token_offset;
+    for (size_t segment_num = 0; segment_num < segments.size();
+	 ++segment_num) {
+	const CorpusSegment &segment = segments[segment_num];
+	if (report_progress) {
+	    progress.StartLine("Sliding window in file " +
+			       to_string(segment_num + 1) + "/" +
+			       to_string(segments.size()));
+	}
+	CorpusReader reader(segment.file_path, segment.begin, segment.end);
+	while (reader.NextPiece(PieceSize(), &line, &line_end)) {
+	    if (report_progress || shared_progress != nullptr) {
+		progress.Update(num_bytes_done + reader.position() -
+				segment.begin, num_tokens);
+	    }
+	    if (line.size == 0) { continue; }
+	    string_manipulator.Split(line, ' ', &tokens);
+	    // Words of a skipped line still count as in CountWordsInSegments.
+	    bool skip_line = sentence_per_line_ &&
+		tokens.size() > kMaxSentenceLength_;
+	    if (skip_line && !shard->provisional_words) {
+		if (!keep_probability_.empty()) {
+		    for (const StringPiece &token_piece : tokens) {
+			token.assign(token_piece.data, token_piece.size);
+			if (!SkipThisString(token)) { ++token_index; }
+		    }
+		}
+		continue;
+	    }
+	    for (const StringPiece &token_piece : tokens) {
+		token.assign(token_piece.data, token_piece.size);
+		if (SkipThisString(token)) { continue; }
+		Word word;
+		if (shard->provisional_words) {
+		    word = AddProvisionalWordIfUnknown(token, shard);
+		    ++shard->word_count[word];
+		    ++shard->num_words;
+		    if (skip_line) { continue; }
+		} else {
+		    auto word_pair = word_str2num_.find(token);
+		    if (word_pair != word_str2num_.end()) {
+			word = word_pair->second;
+		    } else {
+			ASSERT(rare_word_ != string::npos, "Word not in the "
+			       "dictionary without rare words: " << token);
+			word = rare_word_;
+		    }
+		}
+		if (!keep_probability_.empty() &&
+		    !KeepWord(word, seed_key ^ token_index++)) {
+		    continue;
+		}
+		PushWindowWord(word, word_index, &window, shard);
+		++num_tokens;
+	    }
+	    if (sentence_per_line_ && !skip_line) {
+		FinishWindow(word_index, buffer_word, &window, shard);
+	    }
+	}
+	if (!sentence_per_line_) {
+	    FinishWindow(word_index, buffer_word, &window, shard);
+	}
+	num_bytes_done += reader.position() - segment.begin;
+	if (report_progress) { progress.EndLine(""); }
+    }
+    if (shared_progress != nullptr) {
+	progress.Report(num_bytes_done, num_tokens);
+    }
+}
+
+void WordRep::SlideWindowOverIds(const uint32_t *ids, size_t num_ids,
+				 size_t token_offset, size_t word_index,
+				 bool report_progress,
+				 ProgressReporter *shared_progress,
+				 CountShard *shard) {
+    WordWindow window(window_size_);
+    for (size_t buffering = 0; buffering < word_index; ++buffering) {
+	window.push_back(buffer_word_);
+    }
+    ProgressReporter progress(num_ids, kReportInterval_);
+    if (report_progress) { progress.StartLine("Sliding window over word IDs"); }
+    if (shared_progress != nullptr) { progress.ShareWith(shared_progress); }
+    uint64_t seed_key = MixBits(subsample_seed_);  // Keyed by token index
+    size_t token_index = token_offset;
+    bool sentence_start = true;
+    for (size_t i = 0; i < num_ids; ++i) {
+	if (report_progress || shared_progress != nullptr) {
+	    progress.Update(i, i);
+	}
+	if (sentence_per_line_ && sentence_start) {
+	    // Skip the sentence if its line is too long.
+	    size_t end = i;
+	    while (end < num_ids && ids[end] < TokenIdReader::kLongSentenceEnd) {
+		++end;
+	    }
+	    if (end < num_ids && ids[end] == TokenIdReader::kLongSentenceEnd) {
+		token_index += end - i;
+		i = end;
+		continue;
+	    }
+	    sentence_start = false;
+	}
+	if (ids[i] == TokenIdReader::kSentenceEnd) {
+	    if (sentence_per_line_) {
+		FinishWindow(word_index, buffer_word_, &window, shard);
+		sentence_start = true;
+	    }
+	} else if (ids[i] == TokenIdReader::kLongSentenceEnd) {
+	    continue;  // Only in whole-text mode
+	} else if (ids[i] == TokenIdReader::kUnknownWord) {
+	    ASSERT(false, "Word not in the dictionary without rare words in "
+		   "the word IDs");
+	} else if (ids[i] == TokenIdReader::kFileEnd) {
+	    if (!sentence_per_line_) {
+		FinishWindow(word_index, buffer_word_, &window, shard);
+	    }
+	    sentence_start = true;
+	} else if (keep_probability_.empty() ||
+		   KeepWord(ids[i], seed_key ^ token_index++)) {
+	    PushWindowWord(ids[i], word_index, &window, shard);
+	}
+    }
+    if (report_progress) { progress.EndLine(""); }
+    if (shared_progress != nullptr) { progress.Report(num_ids, num_ids); }
+}
+
+void WordRep::WriteTokenIds(const vector<string> &file_list) {
+    if (verbose_) { cerr << "Caching word IDs of the corpus" << endl; }
+    ASSERT(window_word_num2str_.size() < TokenIdReader::kUnknownWord,
+	   "Too many word types for 32-bit IDs: "
+	   << window_word_num2str_.size());
+    vector<vector<CorpusSegment> > parts;
+    SplitCorpus(file_list, max(num_threads_, (size_t) 1), true, &parts);
+    vector<string> part_paths;
+    for (size_t part_num = 0; part_num < parts.size(); ++part_num) {
+	part_paths.push_back(TokenIdsPath() + ".part" + to_string(part_num));
+    }
+    vector<thread> workers;
+    for (size_t part_num = 0; part_num < parts.size(); ++part_num) {
+	workers.push_back(thread(&WordRep::WriteTokenIdsOfSegments, this,
+				 cref(parts[part_num]),
+				 cref(part_paths[part_num])));
+    }
+    for (thread &worker : workers) { worker.join(); }
+
+    // Concatenate the parts after the header. The file appears under its
+    // name only when complete.
+    FileManipulator file_manipulator;
+    TokenIdReader::Header header = {VocabularySignature(), 0};
+    for (const string &file_path : file_list) {
+	header.corpus_size += file_manipulator.Size(file_path);
+    }
+    string temp_path = TokenIdsPath() + ".tmp";
+    ofstream ids_file(temp_path, ios::out | ios::binary);
+    ASSERT(ids_file.is_open(), "Cannot open file: " << temp_path);
+    ids_file.write((const char *) &header, sizeof(header));
+    for (const string &part_path : part_paths) {
+	ifstream part_file(part_path, ios::in | ios::binary);
+	ASSERT(part_file.is_open(), "Cannot open file: " << part_path);
+	if (part_file.peek() != EOF) { ids_file << part_file.rdbuf(); }
+	part_file.close();
+	remove(part_path.c_str());
+    }
+    ids_file.close();
+    ASSERT(!ids_file.fail(), "Cannot write file: " << temp_path);
+    ASSERT(rename(temp_path.c_str(), TokenIdsPath().c_str()) == 0,
+	   "Cannot rename " << temp_path << " to " << TokenIdsPath());
+}
+
+void WordRep::WriteTokenIdsOfSegments(const vector<CorpusSegment> &segments,
+				      const string &ids_path) {
+    ofstream ids_file(ids_path, ios::out | ios::binary);
+    ASSERT(ids_file.is_open(), "Cannot open file: " << ids_path);
+    vector<uint32_t> block;
+    auto add_id = [&](uint32_t id) {
+	block.push_back(id);
+	if (block.size() == 65536) {
+	    ids_file.write((const char *) block.data(),
+			   block.size() * sizeof(uint32_t));
+	    block.clear();
+	}
+    };
+    FileManipulator file_manipulator;
+    StringManipulator string_manipulator;
+    StringPiece line;
+    vector<StringPiece> tokens;
+    string token;
+    for (const CorpusSegment &segment : segments) {
+	// Lines are read in pieces: the end of a line too long to be a
+	// sentence is marked as such. Words of such lines may be missing from
+	// a dictionary made with a sentence per line.
+	CorpusReader reader(segment.file_path, segment.begin, segment.end);
+	size_t line_size = 0;
+	size_t num_line_tokens = 0;
+	string unknown_token;  // Not in the dictionary without rare words
+	bool line_end;
+	while (reader.NextPiece(kMaxPieceSize_, &line, &line_end)) {
+	    line_size += line.size;
+	    string_manipulator.Split(line, ' ', &tokens);
+	    num_line_tokens += tokens.size();
+	    for (const StringPiece &token_piece : tokens) {
+		token.assign(token_piece.data, token_piece.size);
+		if (SkipThisString(token)) { continue; }
+		auto word_pair = word_str2num_.find(token);
+		if (word_pair != word_str2num_.end()) {
+		    add_id(word_pair->second);
+		} else if (rare_word_ != string::npos) {
+		    add_id(rare_word_);
+		} else {
+		    if (unknown_token.empty()) { unknown_token = token; }
+		    add_id(TokenIdReader::kUnknownWord);
+		}
+	    }
+	    if (!line_end) { continue; }
+	    ASSERT(unknown_token.empty() || num_line_tokens >
+		   kMaxSentenceLength_, "Word not in the dictionary without "
+		   "rare words: " << unknown_token);
+	    if (line_size > 0) {
+		add_id((num_line_tokens > kMaxSentenceLength_) ?
+		       TokenIdReader::kLongSentenceEnd :
+		       TokenIdReader::kSentenceEnd);
+	    }
+	    line_size = 0;
+	    num_line_tokens = 0;
+	    unknown_token.clear();
+	}
+	if (segment.end == file_manipulator.Size(segment.file_path)) {
+	    add_id(TokenIdReader::kFileEnd);
+	}
+    }
+    ids_file.write((const char *) block.data(),
+		   block.size() * sizeof(uint32_t));
+    ASSERT(!ids_file.fail(), "Cannot write file: " << ids_path);
+}
+
+void WordRep::SplitTokenIds(const uint32_t *ids, size_t num_ids,
+			    size_t num_parts,
+			    vector<pair<size_t, size_t> > *parts) {
+    // Part k ends near ID k * num_ids / num_parts, moved forward past the
+    // next boundary (where the window is finished anyway).
+    auto is_boundary = [&](uint32_t id) {
+	return (sentence_per_line_) ? (id == TokenIdReader::kSentenceEnd ||
+				       id == TokenIdReader::kLongSentenceEnd) :
+	    id == TokenIdReader::kFileEnd;
+    };
+    parts->clear();
+    size_t begin = 0;
+    for (size_t part_num = 1; part_num <= num_parts; ++part_num) {
+	size_t end = max(begin, num_ids / num_parts * part_num);
+	if (part_num == num_parts) {
+	    end = num_ids;
+	} else {
+	    while (end < num_ids && (end == 0 || !is_boundary(ids[end - 1]))) {
+		++end;
+	    }
+	}
+	if (end > begin) { parts->push_back(make_pair(begin, end)); }
+	begin = end;
+    }
+    if (parts->empty()) { parts->push_back(make_pair(0, 0)); }
+}
+
+uint64_t WordRep::VocabularySignature() {
+    uint64_t signature = 14695981039346656037ULL;  // FNV-1a
+    for (const string &word_string : window_word_num2str_) {
+	for (char c : word_string) {
+	    signature = (signature ^ (unsigned char) c) * 1099511628211ULL;
+	}
+	signature = (signature ^ 0xFF) * 1099511628211ULL;  // Separator
+    }
+    return (signature ^ TokenIdReader::kFormat) * 1099511628211ULL;
+}
+
+void WordRep::MergeCountShards(vector<CountShard> *shards) {
+    CountShard *merged = &(*shards)[0];
+
+    // Sketches are kept until all contexts have merged IDs.
+    bool approximate = merged->sketch.initialized();
+    vector<CooccurrenceSketch> sketches;
+    vector<vector<Context> > merged_contexts;
+    if (approximate) {
+	sketches.push_back(move(merged->sketch));
+	merged_contexts.push_back(vector<Context>(NumContexts(*merged)));
+	for (Context context = 0; context < NumContexts(*merged); ++context) {
+	    merged_contexts[0][context] = context;
+	}
+    }
+    for (size_t shard_num = 1; shard_num < shards->size(); ++shard_num) {
+	CountShard *shard = &(*shards)[shard_num];
+
+	// Local word IDs => merged word IDs (if words are provisional).
+	vector<Word> merged_word(shard->word_num2str.size());
+	for (Word word = 0; word < shard->word_num2str.size(); ++word) {
+	    merged_word[word] =
+		AddProvisionalWordIfUnknown(shard->word_num2str[word], merged);
+	    merged->word_count[merged_word[word]] += shard->word_count[word];
+	}
+	merged->num_words += shard->num_words;
+
+	// Local context IDs in order of first appearance => merged IDs (hash
+	// buckets are the same in every shard).
+	vector<Context> merged_context(NumContexts(*shard));
+	for (Context context = 0; context < merged_context.size(); ++context) {
+	    if (BucketedContexts(*shard)) {
+		merged_context[context] = context;
+		continue;
+	    }
+	    ContextRecipe recipe = shard->context_recipes[context];
+	    if (merged->provisional_words) {
+		recipe.word1 = merged_word[recipe.word1];
+		if (recipe.word2 != string::npos) {
+		    recipe.word2 = merged_word[recipe.word2];
+		}
+	    }
+	    merged_context[context] = AddContextIfUnknown(
+		recipe.position, recipe.word1, recipe.word2, merged);
+	}
+
+	shard->count_word_context.ForEach(
+	    [&](size_t context, size_t word, uint64_t count) {
+		if (OverBudget(*merged, 1)) {
+		    SpillCounts(merged, num_threads_);
+		}
+		merged->count_word_context.Add(
+		    merged_context[context], (merged->provisional_words) ?
+		    merged_word[word] : word, count);
+	    });
+	if (!BucketedContexts(*shard) && !shard->run_paths.empty()) {
+	    RenumberRuns(merged_context, (merged->provisional_words) ?
+			 merged_word : vector<Word>(), RunBudget(merged),
+			 shard);
+	}
+	merged->run_paths.insert(merged->run_paths.end(),
+				 shard->run_paths.begin(),
+				 shard->run_paths.end());
+	if (approximate) {
+	    merged->word_marginal.resize(max(merged->word_marginal.size(),
+					     shard->word_marginal.size()), 0);
+	    for (Word word = 0; word < shard->word_marginal.size(); ++word) {
+		merged->word_marginal[word] += shard->word_marginal[word];
+	    }
+	    merged->context_marginal.resize(NumContexts(*merged), 0);
+	    for (Context context = 0; context < shard->context_marginal.size();
+		 ++context) {
+		merged->context_marginal[merged_context[context]] +=
+		    shard->context_marginal[context];
+	    }
+	    sketches.push_back(move(shard->sketch));
+	    merged_contexts.push_back(move(merged_context));
+	}
+	*shard = CountShard();  // Free memory as we go.
+    }
+    if (approximate) { AddHeavyPairs(sketches, merged_contexts, merged); }
+}
+
+void WordRep::FlushToSketch(CountShard *shard) {
+    shard->word_marginal.resize(window_word_num2str_.size(), 0);
+    shard->context_marginal.resize(NumContexts(*shard), 0);
+    shard->count_word_context.ForEach(
+	[&](size_t context, size_t word, uint64_t count) {
+	    shard->sketch.Add(context, word, count);
+	    shard->word_marginal[word] += count;
+	    shard->context_marginal[context] += count;
+	});
+    shard->count_word_context.Clear();
+}
+
+void WordRep::AddHeavyPairs(const vector<CooccurrenceSketch> &sketches,
+			    const vector<vector<Context> > &merged_contexts,
+			    CountShard *merged) {
+    unordered_map<uint64_t, uint64_t> estimates;  // Merged key => estimate
+    for (size_t shard_num = 0; shard_num < sketches.size(); ++shard_num) {
+	sketches[shard_num].ForEachCandidate([&](size_t context, size_t word) {
+		estimates[((uint64_t) merged_contexts[shard_num][context] << 32)
+			  | word] = 0;
+	    });
+    }
+    uint64_t total = 0;
+    for (size_t shard_num = 0; shard_num < sketches.size(); ++shard_num) {
+	vector<Context> local_context(NumContexts(*merged), string::npos);
+	for (Context context = 0;
+	     context < merged_contexts[shard_num].size(); ++context) {
+	    local_context[merged_contexts[shard_num][context]] = context;
+	}
+	for (auto &estimate_pair : estimates) {
+	    Context context = local_context[estimate_pair.first >> 32];
+	    if (context == string::npos) { continue; }  // Not in this shard
+	    estimate_pair.second += sketches[shard_num].Estimate(
+		context, estimate_pair.first & UINT32_MAX);
+	}
+	total += sketches[shard_num].total();
+    }
+
+    // Keep the heaviest pairs.
+    vector<pair<uint64_t, uint64_t> > heavy_pairs(estimates.begin(),
+						  estimates.end());
+    unordered_map<uint64_t, uint64_t>().swap(estimates);
+    size_t num_pairs = min(heavy_pairs.size(),
+			   max((sketch_memory_ << 20) / 4 / 64, (size_t) 1));
+    partial_sort(heavy_pairs.begin(), heavy_pairs.begin() + num_pairs,
+		 heavy_pairs.end(), [](const pair<uint64_t, uint64_t> &left,
+				       const pair<uint64_t, uint64_t> &right) {
+		     return left.second > right.second ||
+			 (left.second == right.second &&
+			  left.first < right.first);
+		 });
+    heavy_pairs.resize(num_pairs);
+    for (const auto &heavy_pair : heavy_pairs) {
+	merged->count_word_context.Add(heavy_pair.first >> 32,
+				       heavy_pair.first & UINT32_MAX,
+				       heavy_pair.second);
+    }
+
+    // The estimate of a shard exceeds the count by at most e / width times
+    // the total count of the shard with probability 1 - e^-depth.
+    size_t width = sketches[0].width();
+    log_ << "   Sketches: " << sketches.size() << " x "
+	 << CooccurrenceSketch::kDepth << " x " << width << " counters"
+	 << endl;
+    log_ << "   Total count: " << total << endl;
+    log_ << "   Overestimate per pair: <= " << exp(1.0) / width * total
+	 << " with probability >= " << max(1.0 - sketches.size() *
+					   exp(-(double)
+					       CooccurrenceSketch::kDepth),
+					   0.0) << endl;
+    log_ << "   Pairs kept: " << heavy_pairs.size() << " of "
+	 << heavy_pairs.capacity() << " candidates (smallest estimate "
+	 << ((heavy_pairs.empty()) ? 0 : heavy_pairs.back().second) << ")"
+	 << endl;
+}
+
+void WordRep::SpillCounts(CountShard *shard, size_t num_threads) {
+    string run_path = shard->run_prefix + to_string(shard->num_runs++);
+    shard->count_word_context.WriteRun(run_path, num_threads);
+    shard->run_paths.push_back(run_path);
+}
+
+size_t WordRep::RunBudget(CountShard *shard) {
+    if (shard->memory_budget == 0) { return 0; }
+    size_t count_budget = CountBudget(*shard);
+    if (2 * shard->count_word_context.memory_usage() > count_budget) {
+	if (shard->count_word_context.size() > 0) {
+	    SpillCounts(shard, num_threads_);
+	} else {
+	    shard->count_word_context.Clear();  // A presized empty table
+	}
+    }
+    size_t memory_usage = shard->count_word_context.memory_usage();
+    return (count_budget > memory_usage) ? count_budget - memory_usage : 1;
+}
+
+void WordRep::RenumberRuns(const vector<Context> &context_map,
+			   const vector<Word> &word_map, size_t memory_budget,
+			   CountShard *shard) {
+    CountShard renumbered;
+    renumbered.memory_budget = memory_budget;
+    renumbered.run_prefix = shard->run_prefix;
+    renumbered.num_runs = shard->num_runs;
+    for (const string &run_path : shard->run_paths) {
+	CooccurrenceCounts::ForEachInRun(
+	    run_path, [&](size_t context, size_t word, uint64_t count) {
+		if (OverBudget(renumbered, 1)) {
+		    SpillCounts(&renumbered, num_threads_);
+		}
+		renumbered.count_word_context.Add(
+		    (context_map.empty()) ? context : context_map[context],
+		    (word_map.empty()) ? word : word_map[word], count);
+	    });
+	remove(run_path.c_str());
+    }
+    if (renumbered.count_word_context.size() > 0) {
+	SpillCounts(&renumbered, num_threads_);
+    }
+    shard->run_paths.swap(renumbered.run_paths);
+    shard->num_runs = renumbered.num_runs;
+}
+
+void WordRep::FoldRareWords(const string &corpus_file, CountShard *shard) {
+    // Write word counts as if they were counted in a separate pass.
+    vector<pair<string, size_t> > sorted_wordcount;
+    for (Word word = 0; word < shard->word_num2str.size(); ++word) {
+	if (shard->word_count[word] == 0) { continue; }  // The buffer string
+	sorted_wordcount.push_back(make_pair(shard->word_num2str[word],
+					     shard->word_count[word]));
+    }
+    WriteWordCounts(corpus_file, shard->num_words, &sorted_wordcount);
+    vector<pair<string, size_t> >().swap(sorted_wordcount);
+    DetermineRareWords();
+
+    // Provisional words => words after the rare cutoff.
+    SetWindowWords();
+    vector<Word> folded_word(shard->word_num2str.size());
+    for (Word word = 0; word < shard->word_num2str.size(); ++word) {
+	const string &word_string = shard->word_num2str[word];
+	auto word_pair = word_str2num_.find(word_string);
+	if (word_string == kBufferString_) {
+	    folded_word[word] = buffer_word_;
+	} else if (word_pair != word_str2num_.end()) {
+	    folded_word[word] = word_pair->second;
+	} else {
+	    folded_word[word] = rare_word_;
+	}
+    }
+
+    // Rebuild contexts in order of first appearance: the first context that
+    // folds into a given context also marks its first appearance.
+    CountShard folded;
+    vector<Context> folded_context(shard->context_recipes.size());
+    for (Context context = 0; context < shard->context_recipes.size();
+	 ++context) {
+	const ContextRecipe &recipe = shard->context_recipes[context];
+	folded_context[context] = AddContextIfUnknown(
+	    recipe.position, folded_word[recipe.word1],
+	    (recipe.word2 != string::npos) ?
+	    folded_word[recipe.word2] : string::npos, &folded);
+    }
+
+    // Sum the counts of folded words and contexts.
+    shard->count_word_context.ForEach(
+	[&](size_t context, size_t word, uint64_t count) {
+	    folded.count_word_context.Add(folded_context[context],
+					  folded_word[word], count);
+	});
+    shard->count_word_context.Clear();
+    folded.memory_budget = shard->memory_budget;
+    folded.max_unigram_index = shard->max_unigram_index;
+    folded.run_prefix = shard->run_prefix;
+    folded.num_runs = shard->num_runs;
+    if (!shard->run_paths.empty()) {
+	size_t memory_budget = RunBudget(&folded);
+	shard->num_runs = folded.num_runs;
+	RenumberRuns(folded_context, folded_word, memory_budget, shard);
+	folded.run_paths.insert(folded.run_paths.end(),
+				shard->run_paths.begin(),
+				shard->run_paths.end());
+	folded.num_runs = shard->num_runs;
+    }
+    *shard = move(folded);
+}
+
+void WordRep::FinishWindow(size_t word_index, Word buffer_word,
+			   WordWindow *window, CountShard *shard) {
     size_t original_window_size = window->size();
     while (window->size() < window_size_) {
 	// First fill up the window in case the sentence was short.
-	(*window).push_back(kBufferString_);  //   [<!> a] -> [<!> a <!> ]
+	window->push_back(buffer_word);  //   [<!> a] -> [<!> a <!> ]
     }
     for (size_t buffering = word_index; buffering < original_window_size;
 	 ++buffering) {
-	ProcessWindow(*window, word_index, position_markers, context_hash,
-		      count_word_context);
-	(*window).pop_front();
-	(*window).push_back(kBufferString_);
+	(this->*process_window_)(*window, word_index, shard);
+	window->pop_front();
+	window->push_back(buffer_word);
     }
-    (*window).clear();
+    window->clear();
     for (size_t buffering = 0; buffering < word_index; ++buffering) {
-	(*window).push_back(kBufferString_);
+	window->push_back(buffer_word);
+    }
+}
+
+WordRep::ContextType WordRep::GetContextType() {
+    if (context_definition_ == "bag") {  // Bag-of-words (BOW)
+	return kBag;
+    } else if (context_definition_ == "bigram") {  // BOW + bigrams
+	return kBigram;
+    } else if (context_definition_ == "skipgram") {  // BOW + skipgrams
+	return kSkipgram;
+    } else if (context_definition_ == "list") {  // List-of-words (LOW)
+	return kList;
+    } else if (context_definition_ == "baglist") {  // BOW+LOW
+	return kBagList;
     }
+    ASSERT(false, "Unknown context definition: " << context_definition_);
+    return kBag;
 }
 
-void WordRep::ProcessWindow(const deque<string> &window,
-			    size_t word_index,
-			    const vector<string> &position_markers,
-			    const hash<string> &context_hash,
-			    unordered_map<Context, unordered_map<Word, double> >
-			    *count_word_context) {
-    Word word = word_str2num_[window.at(word_index)];
+WordRep::WindowProcessor WordRep::ChooseWindowProcessor(
+    ContextType context_type) {
+    switch (context_type) {
+    case kBag: return ChooseWindowProcessor<kBag>();
+    case kBigram: return ChooseWindowProcessor<kBigram>();
+    case kSkipgram: return ChooseWindowProcessor<kSkipgram>();
+    case kList: return ChooseWindowProcessor<kList>();
+    case kBagList: return ChooseWindowProcessor<kBagList>();
+    }
+    return nullptr;
+}
 
-    for (size_t context_index = 0; context_index < window.size();
+template <WordRep::ContextType kContextType>
+WordRep::WindowProcessor WordRep::ChooseWindowProcessor() {
+    switch (window_size_) {
+    case 2: return &WordRep::ProcessWindow<kContextType, 2>;
+    case 3: return &WordRep::ProcessWindow<kContextType, 3>;
+    case 5: return &WordRep::ProcessWindow<kContextType, 5>;
+    case 7: return &WordRep::ProcessWindow<kContextType, 7>;
+    case 11: return &WordRep::ProcessWindow<kContextType, 11>;
+    default: return &WordRep::ProcessWindow<kContextType, 0>;
+    }
+}
+
+template <WordRep::ContextType kContextType, size_t kWindowSize>
+void WordRep::ProcessWindow(const WordWindow &window, size_t word_index,
+			    CountShard *shard) {
+    // Branches on the template parameters are resolved at compile time.
+    const size_t window_size = (kWindowSize > 0) ? kWindowSize : window_size_;
+    if (kWindowSize > 0) { word_index = (kWindowSize - 1) / 2; }
+    const Word *words = window.data();
+    Word word = words[word_index];
+    CooccurrenceCounts *count_word_context = &shard->count_word_context;
+
+    for (size_t context_index = 0; context_index < window_size;
 	 ++context_index) {
 	if (context_index == word_index) { continue; }
-	string context_string = window.at(context_index);
-	if (context_definition_ == "bag") {  // Bag-of-words (BOW)
-	    Context bag_context = AddContextIfUnknown(context_string,
-						      context_hash);
-	    (*count_word_context)[bag_context][word] += 1;
-	} else if (context_definition_ == "bigram") {  // BOW + bigrams
-	    Context bag_context = AddContextIfUnknown(context_string,
-						      context_hash);
-	    (*count_word_context)[bag_context][word] += 1;
-	    if (context_index < window.size() - 1 &&
-		context_index != word_index - 1) {
-		Context bigram_context =
-		    AddContextIfUnknown(context_string + kNGramGlueString_ +
-					window.at(context_index + 1),
-					context_hash);
-		(*count_word_context)[bigram_context][word] += 1;
-	    }
-	} else if (context_definition_ == "skipgram") {  // BOW + skipgrams
-	    Context bag_context = AddContextIfUnknown(context_string,
-						      context_hash);
-	    (*count_word_context)[bag_context][word] += 1;
+	Word context_word = words[context_index];
+	if (kContextType != kList) {  // Bag-of-words (BOW)
+	    Context bag_context = AddContextIfUnknown(string::npos,
+						      context_word,
+						      string::npos, shard);
+	    AddUnigramContextCount(bag_context, context_word, 0, word, shard);
+	}
+	if (kContextType == kList || kContextType == kBagList) {  // LOW
+	    Context list_context = AddContextIfUnknown(context_index,
+						       context_word,
+						       string::npos, shard);
+	    AddUnigramContextCount(list_context, context_word,
+				   context_index + 1, word, shard);
+	}
+	if (kContextType == kBigram && context_index < window_size - 1 &&
+	    context_index != word_index - 1) {  // Bigrams
+	    Context bigram_context =
+		AddContextIfUnknown(string::npos, context_word,
+				    words[context_index + 1], shard);
+	    count_word_context->Add(bigram_context, word);
+	}
+	if (kContextType == kSkipgram) {  // Skipgrams
 	    for (size_t context_index2 = context_index + 1;
-		 context_index2 < window.size(); ++context_index2) {
+		 context_index2 < window_size; ++context_index2) {
 		if (context_index2 == word_index) { continue; }
-		string context_string2 = window.at(context_index2);
-		string ordered_skipgram_string = (context_string <=
-						  context_string2) ?
-		    context_string + kNGramGlueString_ + context_string2 :
-		    context_string2 + kNGramGlueString_ + context_string;
 		Context skipgram_context =
-		    AddContextIfUnknown(ordered_skipgram_string, context_hash);
-		(*count_word_context)[skipgram_context][word] += 1;
-	    }
-	} else if (context_definition_ == "list") {  // List-of-words (LOW)
-	    Context list_context =
-		AddContextIfUnknown(position_markers.at(context_index) +
-				    context_string, context_hash);
-	    (*count_word_context)[list_context][word] += 1;
-	} else if (context_definition_ == "baglist") {  // BOW+LOW
-	    Context bag_context = AddContextIfUnknown(context_string,
-						      context_hash);
-	    Context list_context =
-		AddContextIfUnknown(position_markers.at(context_index) +
-				    context_string, context_hash);
-	    (*count_word_context)[bag_context][word] += 1;
-	    (*count_word_context)[list_context][word] += 1;
-	} else {
-	    ASSERT(false, "Unknown context definition: " <<
-		   context_definition_);
+		    AddContextIfUnknown(string::npos, context_word,
+					words[context_index2], shard);
+		count_word_context->Add(skipgram_context, word);
+	    }
 	}
     }
 }
 
-Context WordRep::AddContextIfUnknown(const string &context_string_given,
-				     const hash<string> &context_hash) {
-    ASSERT(!context_string_given.empty(), "Adding an empty context string!");
+void WordRep::SetKeepProbabilities() {
+    // Counts of words after the rare cutoff (in window word IDs).
+    vector<size_t> word_count(window_word_num2str_.size(), 0);
+    size_t num_words = 0;
+    ifstream sorted_word_types_file(SortedWordTypesPath(), ios::in);
+    string line;
+    vector<string> tokens;
+    StringManipulator string_manipulator;
+    while (getline(sorted_word_types_file, line)) {
+	if (line == "") { continue; }
+	string_manipulator.Split(line, " ", &tokens);
+	auto word_pair = word_str2num_.find(tokens[0]);
+	Word word = (word_pair != word_str2num_.end()) ?
+	    word_pair->second : rare_word_;
+	if (word == string::npos) { continue; }
+	word_count[word] += stol(tokens[1]);
+	num_words += stol(tokens[1]);
+    }
+
+    keep_probability_.assign(word_count.size(), 1.0);
+    double num_kept = 0.0;
+    for (Word word = 0; word < word_count.size(); ++word) {
+	if (word_count[word] == 0) { continue; }
+	double ratio = (double) word_count[word] / num_words /
+	    subsample_threshold_;
+	keep_probability_[word] = min((sqrt(ratio) + 1) / ratio, 1.0);
+	num_kept += keep_probability_[word] * word_count[word];
+    }
+    ostringstream threshold_stream;  // The log has fixed precision.
+    threshold_stream << subsample_threshold_;
+    log_ << "   Subsampling: threshold " << threshold_stream.str() << ", seed "
+	 << subsample_seed_ << " (expected "
+	 << 100 * num_kept / max(num_words, (size_t) 1) << "% of words kept)"
+	 << endl;
+}
+
+Context WordRep::AddContextIfUnknown(size_t position, Word word1, Word word2,
+				     CountShard *shard) {
+    Context *context;
+    if (word2 == string::npos) {  // Bag or list
+	size_t slot = (position != string::npos) ? position + 1 : 0;
+	context = UnigramContext(word1 * (window_size_ + 1) + slot, shard);
+    } else {  // N-gram (skipgrams are unordered)
+	uint64_t key = (context_type_ == kSkipgram && word2 < word1) ?
+	    ((uint64_t) word2 << 32 | word1) : ((uint64_t) word1 << 32 | word2);
+	context = &shard->pair_context.insert(
+	    make_pair(key, (Context) string::npos)).first->second;
+    }
+    if (*context != string::npos) { return *context; }
+
+    // Contexts are hashed only after folding rare words, if they are
+    // provisional.
+    ContextRecipe recipe;
+    recipe.position = position;
+    recipe.word1 = word1;
+    recipe.word2 = word2;
+    if (BucketedContexts(*shard)) {
+	*context = ContextBucket(ContextString(recipe, *shard));
+	return *context;
+    }
+    *context = shard->context_recipes.size();
+    ASSERT(*context < UINT32_MAX, "Too many contexts: " << *context);
+    shard->context_recipes.push_back(recipe);
+    return *context;
+}
 
-    string context_string = context_string_given;
-    if (num_context_hashed_ > 0) {  // Random context hashing.
-	size_t hashed_context = context_hash(context_string);
-	hashed_context %= num_context_hashed_;
-	context_string = to_string(hashed_context);
+string WordRep::ContextString(size_t position, const string &word_string1,
+			      const string &word_string2) {
+    if (position != string::npos) {  // List
+	return position_markers_.at(position) + word_string1;
+    }
+    if (word_string2.empty()) { return word_string1; }  // Bag
+    if (context_definition_ == "skipgram" && word_string2 < word_string1) {
+	return word_string2 + kNGramGlueString_ + word_string1;
     }
+    return word_string1 + kNGramGlueString_ + word_string2;  // N-gram
+}
 
-    if (context_str2num_.find(context_string) == context_str2num_.end()) {
-	Context context = context_str2num_.size();
-	context_str2num_[context_string] = context;
-	context_num2str_[context] = context_string;
+string WordRep::ContextString(const ContextRecipe &recipe,
+			      const CountShard &shard) {
+    return ContextString(recipe.position, WindowWordString(recipe.word1, shard),
+			 (recipe.word2 != string::npos) ?
+			 WindowWordString(recipe.word2, shard) : "");
+}
+
+Context WordRep::ContextBucket(const string &context_string) {
+    uint64_t hash = 14695981039346656037ULL ^ kContextHashSeed_;  // FNV-1a
+    for (char c : context_string) {
+	hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
     }
-    return context_str2num_[context_string];
+    return MixBits(hash) % num_context_hashed_;
+}
+
+void WordRep::SetWindowWords() {
+    window_word_num2str_.assign(word_str2num_.size(), "");
+    for (const auto &word_pair : word_str2num_) {
+	window_word_num2str_[word_pair.second] = word_pair.first;
+    }
+    buffer_word_ = window_word_num2str_.size();
+    window_word_num2str_.push_back(kBufferString_);
+    rare_word_ = (word_str2num_.find(kRareString_) != word_str2num_.end()) ?
+	word_str2num_[kRareString_] : string::npos;
+    ASSERT(window_word_num2str_.size() <= ((uint64_t) 1 << 32),
+	   "Too many word types: " << window_word_num2str_.size());
+}
+
+Word WordRep::AddProvisionalWordIfUnknown(const string &word_string,
+					  CountShard *shard) {
+    auto word_pair = shard->word_str2num.find(word_string);
+    if (word_pair != shard->word_str2num.end()) { return word_pair->second; }
+    Word word = shard->word_num2str.size();
+    ASSERT(word < ((uint64_t) 1 << 32), "Too many word types: " << word);
+    shard->word_str2num[word_string] = word;
+    shard->word_num2str.push_back(word_string);
+    shard->word_count.push_back(0);
+    return word;
 }
 
 void WordRep::InduceWordVectors() {
@@ -543,7 +2444,7 @@ void WordRep::InduceWordVectors() {
     } else {  // Load word vectors.
 	StringManipulator string_manipulator;
 	string line;
-	vector<string> tokens;
+	vector<StringPiece> tokens;
 	wordvectors_.clear();
 	ifstream wordvectors_file(WordVectorsPath(), ios::in);
 	while (wordvectors_file.good()) {
@@ -551,12 +2452,15 @@ void WordRep::InduceWordVectors() {
 	    if (line == "") { continue; }
 
 	    // line = [count] [word_string] [value_{1}] ... [value_{dim_}]
-	    string_manipulator.Split(line, " ", &tokens);
+	    // Each value ends at a space or the end of the line, so it can be
+	    // parsed in place.
+	    string_manipulator.Split(StringPiece{line.data(), line.size()}, ' ',
+				     &tokens);
 	    Eigen::VectorXd vector(tokens.size() - 2);
 	    for (size_t i = 0; i < tokens.size() - 2; ++i) {
-		vector(i) = stod(tokens[i + 2]);
+		vector(i) = strtod(tokens[i + 2].data, nullptr);
 	    }
-	    wordvectors_[tokens[1]] = vector;
+	    wordvectors_[string(tokens[1].data, tokens[1].size)] = vector;
 	}
     }
 }
@@ -911,6 +2815,15 @@ string WordRep::Signature(size_t version) {
 	signature += "_window" + to_string(window_size_);
 	signature += "_" + context_definition_;
 	signature += "_hash" + to_string(num_context_hashed_);
+	if (sketch_memory_ > 0) {  // Approximate counts
+	    signature += "_sketch" + to_string(sketch_memory_);
+	}
+	if (subsample_threshold_ > 0.0) {
+	    ostringstream subsample_stream;
+	    subsample_stream << subsample_threshold_;
+	    signature += "_sub" + subsample_stream.str() + "_seed" +
+		to_string(subsample_seed_);
+	}
     }
     if (version >= 2) {
 	signature += "_dim" + to_string(dim_);
@@ -6,17 +6,144 @@
 #define WORDREP_H
 
 #include <Eigen/Dense>
-#include <deque>
+#include <cstdint>
 #include <fstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "counts.h"
+
 using namespace std;
 
 typedef size_t Word;
 typedef size_t Context;
 
+// Lines of a corpus file starting in the byte range [begin, end).
+struct CorpusSegment {
+    string file_path;
+    size_t begin;
+    size_t end;
+};
+
+// Numbers of distinct items (word types, or (context, word) pairs and
+// contexts) projected for a corpus and for each of its parts.
+struct DistinctEstimate {
+    size_t num_items = 0;
+    size_t num_items_per_part = 0;
+    size_t num_contexts = 0;
+    size_t num_contexts_per_part = 0;
+};
+
+// Words in the window that make up a context: a word (bag), a window
+// position and a word (list), or a pair of words (bigram, skipgram).
+struct ContextRecipe {
+    size_t position;  // string::npos unless a list context
+    Word word1;
+    Word word2;  // string::npos unless an n-gram context
+};
+
+// Counts collected by one worker over a contiguous portion of a corpus.
+// Contexts are numbered locally in order of first appearance, so merging
+// shards in corpus order reproduces the IDs of a sequential pass.
+struct CountShard {
+    // Contexts are identified by the IDs of their words. A single-word
+    // context is found at index word * num_slots + slot (slot 0 for bags, 1
+    // + position for lists): in the dense unigram_context below
+    // max_unigram_index (which keeps it within the memory budget), in
+    // sparse_unigram_context above. A pair context is found at
+    // pair_context[word1 << 32 | word2]. Unknown entries are string::npos.
+    vector<Context> unigram_context;
+    size_t max_unigram_index = string::npos;
+    unordered_map<size_t, Context> sparse_unigram_context;
+    unordered_map<uint64_t, Context> pair_context;
+
+    // Counts of the pairs of head words (the most frequent) and their bag or
+    // list contexts, if the head block is used: the count of word i and the
+    // context of word j and slot s is at ((j * num_slots + s) * num_words +
+    // i), with IDs and slots relative to the head.
+    vector<uint32_t> head_counts;
+
+    // context_recipes[j] = words of context j, from which its string is
+    // built only when needed. If contexts are hashed (and words are not
+    // provisional), the ID of a context is its hash bucket and no recipes
+    // are kept.
+    vector<ContextRecipe> context_recipes;
+
+    CooccurrenceCounts count_word_context;
+
+    // Number of distinct pairs expected, for which the table is presized.
+    size_t expected_num_pairs = 0;
+
+    // If memory_budget (bytes) is nonzero, counts that would outgrow it are
+    // spilled to run files (run_prefix + number), each sorted by key. Runs
+    // are numbered in order of writing (num_runs so far).
+    size_t memory_budget = 0;
+    string run_prefix;
+    vector<string> run_paths;
+    size_t num_runs = 0;
+
+    // If the sketch is initialized, counts are approximate: instead of being
+    // spilled, counts that outgrow the memory budget are moved to the sketch
+    // (see FlushToSketch). The marginals of the counts are kept exact.
+    CooccurrenceSketch sketch;
+    vector<uint64_t> word_marginal;
+    vector<uint64_t> context_marginal;
+
+    // If true, words are not yet filtered by the rare cutoff: they have
+    // provisional IDs local to the shard, so that contexts can later be
+    // rebuilt from their recipes with rare words folded.
+    bool provisional_words = false;
+    unordered_map<string, Word> word_str2num;
+    vector<string> word_num2str;
+    vector<size_t> word_count;
+    size_t num_words = 0;
+};
+
+// Fixed-capacity window of word IDs that slides over a corpus. Each ID is
+// stored twice, at i and i + capacity, so that the window is always a
+// contiguous array.
+class WordWindow {
+public:
+    // Initializes an empty window that can hold the given number of words.
+    WordWindow(size_t capacity) : capacity_(capacity), words_(2 * capacity) { }
+
+    // Appends a word at the end of the window (must not be full).
+    void push_back(Word word) {
+	size_t position = (start_ + size_) % capacity_;
+	words_[position] = word;
+	words_[position + capacity_] = word;
+	++size_;
+    }
+
+    // Removes the word at the front of the window.
+    void pop_front() {
+	start_ = (start_ + 1) % capacity_;
+	--size_;
+    }
+
+    // Removes all words.
+    void clear() {
+	start_ = 0;
+	size_ = 0;
+    }
+
+    // Returns the number of words in the window.
+    size_t size() const { return size_; }
+
+    // Returns the i-th word from the front of the window.
+    Word operator[](size_t i) const { return words_[start_ + i]; }
+
+    // Returns the words of the window as a contiguous array.
+    const Word *data() const { return &words_[start_]; }
+
+private:
+    size_t capacity_;
+    vector<Word> words_;
+    size_t start_ = 0;
+    size_t size_ = 0;
+};
+
 class WordRep {
 public:
     // Initializes empty.
@@ -38,9 +165,44 @@ public:
     // Extracts statistics from a corpus (file or a directory of files).
     void ExtractStatistics(const string &corpus_file);
 
+    // Adds the statistics of the files of a corpus not yet counted (as
+    // recorded in manifests with their sizes and modification times) to the
+    // statistics of the files counted before. Co-occurrences are kept under
+    // rare cutoff 0 and re-bucketed to the rare cutoff, so words can become
+    // frequent as files are appended.
+    void AppendCorpus(const string &corpus_file);
+
+    // Extracts only the word counts of a corpus. These fix the word
+    // dictionary that count shards of the corpus share.
+    void ExtractWordCounts(const string &corpus_file);
+
+    // Counts co-occurrences in a part of a corpus (file or a directory of
+    // files) with the word counts of the whole corpus in the output
+    // directory, writing the counts and their marginals to the shard
+    // directory as if it were the output directory. Shards can be counted by
+    // separate processes (or hosts) at the same time.
+    void CountCorpusShard(const string &corpus_file,
+			  const string &shard_directory);
+
+    // Sums the counts of shard directories into the counts of the output
+    // directory. Contexts are numbered in order of first appearance over the
+    // shards in the given order, so shards of consecutive parts of a corpus
+    // give the counts of a single pass over it.
+    void MergeCorpusShards(const vector<string> &shard_directories);
+
     // Induces lexical representations from cached word counts.
     void InduceLexicalRepresentations();
 
+    // Derives the counts of the window size and context definition (bag,
+    // list, or baglist) from cached list counts of a window that contains
+    // this window, without reading the corpus.
+    void DeriveCounts(size_t list_window_size);
+
+    // Derives the counts of the rare cutoff from cached counts of a smaller
+    // rare cutoff (with the same window settings) by folding the words that
+    // become rare, without reading the corpus.
+    void RebucketCounts(size_t source_rare_cutoff);
+
     // Sets the rare word cutoff value.
     void set_rare_cutoff(size_t rare_cutoff) { rare_cutoff_ = rare_cutoff; }
 
@@ -74,6 +236,48 @@ public:
     // Sets the flag for printing messages to stderr.
     void set_verbose(bool verbose) { verbose_ = verbose; }
 
+    // Sets the number of threads for counting.
+    void set_num_threads(size_t num_threads) { num_threads_ = num_threads; }
+
+    // Sets the flag for counting words and co-occurrences in a single pass
+    // over the corpus.
+    void set_single_pass(bool single_pass) { single_pass_ = single_pass; }
+
+    // Sets the memory limit for co-occurrence counts in megabytes.
+    void set_memory_limit(size_t memory_limit) { memory_limit_ = memory_limit; }
+
+    // Sets the memory for approximate co-occurrence counts in megabytes (0
+    // means exact counts).
+    void set_sketch_memory(size_t sketch_memory) {
+	sketch_memory_ = sketch_memory;
+    }
+
+    // Sets the threshold for subsampling frequent words (0 means none).
+    void set_subsample_threshold(double subsample_threshold) {
+	subsample_threshold_ = subsample_threshold;
+    }
+
+    // Sets the seed for subsampling frequent words.
+    void set_subsample_seed(size_t subsample_seed) {
+	subsample_seed_ = subsample_seed;
+    }
+
+    // Sets the number of most frequent words whose pairs with bag or list
+    // contexts are counted in a dense block (0 means none).
+    void set_head_size(size_t head_size) { head_size_ = head_size; }
+
+    // Sets the flag for counting co-occurrences by sort and reduce.
+    void set_sort_counts(bool sort_counts) { sort_counts_ = sort_counts; }
+
+    // Sets the flag for caching the corpus as word IDs for window sliding.
+    void set_cache_tokens(bool cache_tokens) { cache_tokens_ = cache_tokens; }
+
+    // Sets additional window configurations ("window:context,...") to count
+    // together with the window size and context definition.
+    void set_configurations(const string &configurations) {
+	configurations_ = configurations;
+    }
+
     // Sets the number of context types to hash.
     void set_num_context_hashed(size_t num_context_hashed) {
 	num_context_hashed_ = num_context_hashed;
@@ -113,7 +317,7 @@ public:
 
     // Returns the path to the word count file.
     string CountWordPath() {
-	return output_directory_ + "/count_word_" + Signature(0);
+	return output_directory_ + "/count_word_" + Signature(1);
     }
 
     // Returns the path to the context count file.
@@ -122,7 +326,10 @@ public:
     }
 
     // Loads a filtered word dictionary from a cached file.
-    void LoadWordDictionary();
+    void LoadWordDictionary() { LoadWordDictionary(WordStr2NumPath()); }
+
+    // Loads a word dictionary from the given str2num file.
+    void LoadWordDictionary(const string &file_path);
 
     // Loads a filtered context dictionary from a cached file.
     void LoadContextDictionary();
@@ -143,36 +350,348 @@ private:
     // Extracts the count of each word type appearing in the given corpus.
     void CountWords(const string &corpus_file);
 
+    // Adds the counts of word types in the given files to the given counts.
+    void CountWordsInFiles(const vector<string> &file_list,
+			   unordered_map<string, size_t> *wordcount,
+			   size_t *num_words);
+
+    // Counts word types in the given segments, also on lines too long for a
+    // sentence (so that the word counts are the same with or without a
+    // sentence per line). Progress is reported per file, or passed to a
+    // reporter shared by several threads (if not null).
+    void CountWordsInSegments(const vector<CorpusSegment> &segments,
+			      bool report_progress,
+			      ProgressReporter *shared_progress,
+			      unordered_map<string, size_t> *wordcount,
+			      size_t *num_words);
+
+    // Sorts word types in decreasing frequency and writes them together with
+    // corpus information.
+    void WriteWordCounts(const string &corpus_file, size_t num_words,
+			 vector<pair<string, size_t> > *sorted_wordcount);
+
     // Adds the word to the word dictionary if not already known.
     Word AddWordIfUnknown(const string &word_string);
 
     // Returns true if the given word string will be skipped.
     bool SkipThisString(const string &word_string);
 
+    // Returns the size of the pieces in which lines are tokenized: whole
+    // lines if each line is a sentence, otherwise pieces of kMaxPieceSize_
+    // bytes (see CorpusReader::NextPiece), so that no line is too long to
+    // read.
+    size_t PieceSize() {
+	return (sentence_per_line_) ? string::npos : kMaxPieceSize_;
+    }
+
     // Determines rare word types.
     void DetermineRareWords();
 
-    // Slides a window across a corpus to collect statistics.
-    void SlideWindow(const string &corpus_file);
+    // Slides windows of all configurations across a corpus, reading its text
+    // only once: the corpus is tokenized into word IDs that each
+    // configuration then slides over.
+    void SlideWindows(const string &corpus_file);
+
+    // Slides a window across a corpus to collect statistics. If count_words
+    // is true, words are counted in the same pass and the rare cutoff is
+    // applied afterwards (the word dictionary is not needed beforehand).
+    void SlideWindow(const string &corpus_file, bool count_words);
+
+    // Slides a window across the given files of a corpus.
+    void SlideWindow(const string &corpus_file,
+		     const vector<string> &file_list, bool count_words);
+
+    // Lists the files not in the manifest at the given path. Files in the
+    // manifest must not have changed since.
+    void FilesNotInManifest(const vector<string> &file_list,
+			    const string &manifest_path,
+			    vector<string> *new_files);
+
+    // Adds the files to the manifest at the given path.
+    void AddToManifest(const vector<string> &file_list,
+		       const string &manifest_path);
+
+    // Adds old counts (with their word and context dictionaries) to the
+    // cached counts and writes the sums in their place.
+    void AddCounts(SMat old_counts,
+		   const unordered_map<Word, string> &old_word_num2str,
+		   const unordered_map<string, Context> &old_context_str2num,
+		   const unordered_map<Context, string> &old_context_num2str);
+
+    // Removes the files computed from the counts of the current signature
+    // (singular values, word vectors, clusters), and if counts is true, the
+    // counts themselves.
+    void RemoveDerivedFiles(bool counts);
+
+    // Returns the context string with the words not in the filtered word
+    // dictionary replaced by the rare symbol.
+    string FoldContextString(const string &context_string);
+
+    // Writes the counts (and the filtered context dictionary) to the count
+    // files and clears the word and context dictionaries.
+    void WriteCounts(CountShard *counts);
+
+    // Splits the files into at most num_parts contiguous lists of segments
+    // of roughly equal size. Segments are line-aligned pieces of files if
+    // split_files is true, otherwise whole files.
+    void SplitCorpus(const vector<string> &file_list, size_t num_parts,
+		     bool split_files, vector<vector<CorpusSegment> > *parts);
+
+    // Estimates the numbers of distinct word types (if pairs is false) or
+    // distinct pairs and contexts in the corpus and in each of the given
+    // number of parts from evenly spaced samples of the corpus. The number
+    // of distinct items in n bytes is taken to grow as n^b (Heaps' law) with
+    // b fitted from the first half of the samples and all of them. Returns
+    // false if the corpus cannot be sampled (e.g., it is streamed).
+    bool EstimateDistinct(const vector<string> &file_list, bool pairs,
+			  size_t num_parts, DistinctEstimate *estimate);
+
+    // Adds the (context, word) pairs of a full window, and their contexts, to
+    // the given counters of distinct keys.
+    void SamplePairs(const WordWindow &window, HyperLogLog *pair_counter,
+		     HyperLogLog *context_counter);
+
+    // Presizes the table of the shard for its expected number of pairs, as
+    // far as its memory budget (or else a quarter of the available memory)
+    // allows.
+    void PresizeCounts(CountShard *shard);
+
+    // Logs a warning if the given number of bytes, projected for the given
+    // item, exceeds the available memory.
+    void WarnIfOverMemory(const string &item, size_t num_bytes);
+
+    // Returns the total number of bytes of the segments.
+    size_t SegmentBytes(const vector<CorpusSegment> &segments);
+
+    // Returns the number of tokens in the given segments.
+    size_t CountTokensInSegments(const vector<CorpusSegment> &segments);
+
+    // Slides a window across the given segments, counting into the shard.
+    // The segments start at the given token index in the corpus (which keys
+    // subsampling). Progress is passed to the shared reporter as in
+    // CountWordsInSegments.
+    void SlideWindowOverSegments(const vector<CorpusSegment> &segments,
+				 size_t token_offset, size_t word_index,
+				 bool report_progress,
+				 ProgressReporter *shared_progress,
+				 CountShard *shard);
+
+    // Slides a window across word IDs cached by WriteTokenIds (with markers),
+    // counting into the shard. The IDs start at the given token index in the
+    // corpus as in SlideWindowOverSegments.
+    void SlideWindowOverIds(const uint32_t *ids, size_t num_ids,
+			    size_t token_offset, size_t word_index,
+			    bool report_progress,
+			    ProgressReporter *shared_progress,
+			    CountShard *shard);
+
+    // Appends a word to the window: processes the window if it is full and
+    // spills the counts of the shard if they outgrow its memory budget.
+    void PushWindowWord(Word word, size_t word_index, WordWindow *window,
+			CountShard *shard);
+
+    // Returns true if adding the given number of new pairs to the counts of
+    // the shard could take more than its memory budget, counting the slots
+    // of the table before and after it grows.
+    bool OverBudget(const CountShard &shard, size_t num_new_pairs) {
+	return shard.memory_budget > 0 && shard.count_word_context.size() > 0 &&
+	    shard.count_word_context.peak_memory_usage(num_new_pairs) >
+	    CountBudget(shard);
+    }
+
+    // Spills the counts of the shard (or moves them to its sketch) before
+    // adding the given number of new pairs could outgrow its memory budget.
+    void ReleaseMemory(CountShard *shard, size_t num_new_pairs);
+
+    // Moves the counts of the shard's head block to its sparse counts and
+    // frees the block.
+    void FlushHeadCounts(CountShard *shard);
+
+    // Writes the files tokenized into filtered word IDs (see TokenIdReader)
+    // to the token ID file.
+    void WriteTokenIds(const vector<string> &file_list);
+
+    // Writes the IDs (and markers) of the words in the given segments.
+    void WriteTokenIdsOfSegments(const vector<CorpusSegment> &segments,
+				 const string &ids_path);
+
+    // Splits the cached IDs into at most num_parts ranges [begin, end) of
+    // roughly equal size that end at sentence (or file) boundaries.
+    void SplitTokenIds(const uint32_t *ids, size_t num_ids, size_t num_parts,
+		       vector<pair<size_t, size_t> > *parts);
+
+    // Returns a hash of the word strings in the window (in ID order), which
+    // identifies the vocabulary that cached IDs refer to.
+    uint64_t VocabularySignature();
+
+    // Merges shards (in corpus order) into the first shard. The other shards
+    // are emptied in the process.
+    void MergeCountShards(vector<CountShard> *shards);
+
+    // Writes the counts of the shard to a new run file (sorted with the given
+    // number of threads) and empties them.
+    void SpillCounts(CountShard *shard, size_t num_threads);
+
+    // Computes the probability of keeping each word when subsampling: a word
+    // of relative frequency f above the threshold t is kept with
+    // probability (sqrt(f / t) + 1) t / f, as in word2vec.
+    void SetKeepProbabilities();
+
+    // Returns true if an occurrence of the word with the given key (unique to
+    // the index of the token in the corpus) survives subsampling.
+    bool KeepWord(Word word, uint64_t key) {
+	return (MixBits(key) >> 11) * (1.0 / (1ULL << 53)) <
+	    keep_probability_[word];
+    }
+
+    // Moves the counts of the shard to its sketch, adding them to its
+    // marginals.
+    void FlushToSketch(CountShard *shard);
+
+    // Estimates the counts of the candidate pairs of the sketches of merged
+    // shards (summed over the shards) and adds those of the heaviest pairs to
+    // the merged shard. merged_contexts[k] maps the context IDs of shard k to
+    // merged IDs.
+    void AddHeavyPairs(const vector<CooccurrenceSketch> &sketches,
+		       const vector<vector<Context> > &merged_contexts,
+		       CountShard *merged);
+
+    // Replaces the run files of the shard with runs whose contexts and words
+    // are renumbered by the given maps (see CooccurrenceCounts::AddRun). The
+    // runs are streamed through a table that spills to new runs beyond the
+    // given memory budget (0 if none).
+    void RenumberRuns(const vector<Context> &context_map,
+		      const vector<Word> &word_map, size_t memory_budget,
+		      CountShard *shard);
+
+    // Returns the bytes of the shard's memory budget left for renumbering
+    // runs beside its counts (0 if it has no budget), spilling the counts
+    // first if they take more than half of the budget.
+    size_t RunBudget(CountShard *shard);
+
+    // Writes word counts of a shard with provisional words, determines rare
+    // words, and folds them into the rare symbol in both words and contexts.
+    void FoldRareWords(const string &corpus_file, CountShard *shard);
+
+    // Processes the remaining windows at the end of a sentence and resets
+    // the window with start buffering.
+    void FinishWindow(size_t word_index, Word buffer_word, WordWindow *window,
+		      CountShard *shard);
+
+    // Context definitions, each with its own window processors.
+    enum ContextType { kBag, kBigram, kSkipgram, kList, kBagList };
+
+    // Increments word/context counts from a full window of text.
+    typedef void (WordRep::*WindowProcessor)(const WordWindow &window,
+					     size_t word_index,
+					     CountShard *shard);
+
+    // Returns the context type of the context definition.
+    ContextType GetContextType();
+
+    // Returns the window processor for the context type, specialized to the
+    // window size if it is a common one.
+    WindowProcessor ChooseWindowProcessor(ContextType context_type);
+
+    // Returns the window processor for the given context type, specialized
+    // to the window size if it is a common one.
+    template <ContextType kContextType>
+    WindowProcessor ChooseWindowProcessor();
+
+    // Window processor for the given context type and window size (0 means
+    // window_size_), so that the inner loop has no branching on either.
+    template <ContextType kContextType, size_t kWindowSize>
+    void ProcessWindow(const WordWindow &window, size_t word_index,
+		       CountShard *shard);
+
+    // Adds 1 to the count of a word and a bag or list context of the given
+    // word and slot (see CountShard): in the head block if both words are in
+    // the head, otherwise in the sparse counts.
+    void AddUnigramContextCount(Context context, Word context_word,
+				size_t slot, Word word, CountShard *shard) {
+	if (word < head_begin_ || context_word < head_begin_) {
+	    shard->count_word_context.Add(context, word);
+	    return;
+	}
+	uint32_t *count = &shard->head_counts[
+	    ((context_word - head_begin_) * num_head_slots_ + slot -
+	     head_slot_offset_ - (slot > head_center_slot_)) * num_head_words_ +
+	    word - head_begin_];
+	if (++*count == UINT32_MAX) {  // Move a full count to the sparse counts.
+	    shard->count_word_context.Add(context, word, *count);
+	    *count = 0;
+	}
+    }
+
+    // Returns the entry of the single-word context at the given index (see
+    // CountShard), string::npos if unknown.
+    Context *UnigramContext(size_t index, CountShard *shard) {
+	if (index >= shard->unigram_context.size()) {
+	    if (index >= shard->max_unigram_index) {
+		return &shard->sparse_unigram_context.insert(
+		    make_pair(index, (Context) string::npos)).first->second;
+	    }
+	    shard->unigram_context.resize(
+		min(max(index + 1, 2 * shard->unigram_context.size()),
+		    shard->max_unigram_index), string::npos);
+	}
+	return &shard->unigram_context[index];
+    }
+
+    // Returns the bytes of the shard's memory budget left for its counts
+    // once its single-word contexts are indexed and its head block is held.
+    size_t CountBudget(const CountShard &shard) {
+	size_t held_bytes = shard.unigram_context.capacity() *
+	    sizeof(Context) + shard.sparse_unigram_context.size() *
+	    kMapEntryBytes_ + shard.head_counts.capacity() * sizeof(uint32_t);
+	return (shard.memory_budget > held_bytes) ?
+	    shard.memory_budget - held_bytes : 0;
+    }
+
+    // Adds the context made of the given window words (see ContextString) to
+    // the shard's context dictionary if not already known. The second word
+    // is string::npos unless the context is an n-gram.
+    Context AddContextIfUnknown(size_t position, Word word1, Word word2,
+				CountShard *shard);
+
+    // Returns the string of a word in the window.
+    const string &WindowWordString(Word word, const CountShard &shard) {
+	return (shard.provisional_words) ?
+	    shard.word_num2str[word] : window_word_num2str_[word];
+    }
+
+    // Sets the word strings and reserved IDs used in the window from the
+    // filtered word dictionary.
+    void SetWindowWords();
 
-    void FinishWindow(size_t word_index,
-		      const vector<string> &position_markers,
-		      const hash<string> &context_hash,
-		      deque<string> *window,
-		      unordered_map<Context, unordered_map<Word, double> >
-		      *count_word_context);
+    // Returns the string of the context made of the given window words:
+    // a word if position is string::npos and word_string2 is empty, a
+    // position marker and a word if position is given, and an n-gram
+    // (ordered for skipgrams) if word_string2 is given.
+    string ContextString(size_t position, const string &word_string1,
+			 const string &word_string2);
 
-    // Increments word/context counts from a window of text.
-    void ProcessWindow(const deque<string> &window,
-		       size_t word_index,
-		       const vector<string> &position_markers,
-		       const hash<string> &context_hash,
-		       unordered_map<Context, unordered_map<Word, double> >
-		       *count_word_context);
+    // Returns the string of the context with the given recipe in the shard.
+    string ContextString(const ContextRecipe &recipe, const CountShard &shard);
 
-    // Adds the context to the context dictionary if not already known.
-    Context AddContextIfUnknown(const string &context_string_given,
-				const hash<string> &context_hash);
+    // Returns the hash bucket of a context string (contexts must be hashed).
+    Context ContextBucket(const string &context_string);
+
+    // Returns true if the context IDs of the shard are hash buckets.
+    bool BucketedContexts(const CountShard &shard) {
+	return num_context_hashed_ > 0 && !shard.provisional_words;
+    }
+
+    // Returns the number of context IDs of the shard.
+    size_t NumContexts(const CountShard &shard) {
+	return (BucketedContexts(shard)) ?
+	    num_context_hashed_ : shard.context_recipes.size();
+    }
+
+    // Adds the word to the shard's provisional word dictionary if not
+    // already known.
+    Word AddProvisionalWordIfUnknown(const string &word_string,
+				     CountShard *shard);
 
     // Induces vector representations of word types based on cached count files.
     void InduceWordVectors();
@@ -221,6 +740,27 @@ private:
 	return output_directory_ + "/word_str2num_" + Signature(0);
     }
 
+    // Returns the path to the corpus tokenized into word IDs.
+    string TokenIdsPath() {
+	return output_directory_ + "/token_ids_" + Signature(0);
+    }
+
+    // Returns the path to the manifest of files whose words are counted.
+    string WordManifestPath() { return output_directory_ + "/manifest_words"; }
+
+    // Returns the path to the manifest of files whose co-occurrences are
+    // counted.
+    string CountManifestPath() {
+	return output_directory_ + "/manifest_" + Signature(1);
+    }
+
+    // Returns the path to the str2num mapping for the words of the
+    // co-occurrence counts made with --append (the word IDs change when
+    // another configuration appends files).
+    string CountWordStr2NumPath() {
+	return output_directory_ + "/word_str2num_" + Signature(1);
+    }
+
     // Returns the path to the str2num mapping for context.
     string ContextStr2NumPath() {
 	return output_directory_ + "/context_str2num_" + Signature(1);
@@ -256,6 +796,21 @@ private:
     // Maps a context integer ID to its original string form.
     unordered_map<Context, string> context_num2str_;
 
+    // position_markers_[i] = marker of the i-th window position for list
+    // contexts, e.g., "w(-1)=" (empty for the center word).
+    vector<string> position_markers_;
+
+    // window_word_num2str_[i] = string of word i in the window: filtered words,
+    // then the buffer symbol with reserved ID kept in buffer_word_. Words not
+    // in the dictionary enter the window as rare_word_.
+    vector<string> window_word_num2str_;
+    Word buffer_word_;
+    Word rare_word_;
+
+    // Context type and window processor for the current window sliding.
+    ContextType context_type_ = kBag;
+    WindowProcessor process_window_ = nullptr;
+
     // Path to the log file.
     ofstream log_;
 
@@ -268,15 +823,38 @@ private:
     // Special string for glueing words to n-gram features.
     const string kNGramGlueString_ = "<+>";
 
+    // Seed of the hash of context strings, fixed so that buckets are the same
+    // across runs and platforms.
+    const uint64_t kContextHashSeed_ = 0x5bd1e9955bd1e995ULL;
+
     // Maximum word length to consider.
     const size_t kMaxWordLength_ = 100;
 
-    // Maximum sentence length to consider.
+    // Maximum sentence length to consider (lines are not sentences in
+    // whole-text mode, so they can have any length).
     const size_t kMaxSentenceLength_ = 1000;
 
+    // Bytes of a line tokenized at a time in whole-text mode.
+    const size_t kMaxPieceSize_ = 1 << 20;
+
+    // Bytes of a corpus sampled to estimate numbers of distinct items, and
+    // the number of evenly spaced samples they are taken in.
+    const size_t kSampleBytes_ = 1 << 24;
+    const size_t kNumSamples_ = 16;
+
+    // Bytes taken by a word type in a map of word counts (approximately).
+    const size_t kWordTypeBytes_ = 64;
+
+    // Bytes taken by an entry of a hash map of integers (approximately).
+    const size_t kMapEntryBytes_ = 32;
+
     // Interval to report progress.
     const double kReportInterval_ = 0.1;
 
+    // Number of pairs a worker buffers for sort and reduce (without a memory
+    // limit).
+    const size_t kSortBufferSize_ = 1 << 22;
+
     // Computed word vectors.
     unordered_map<string, Eigen::VectorXd> wordvectors_;
 
@@ -328,6 +906,52 @@ private:
 
     // Print messages to stderr?
     bool verbose_ = true;
+
+    // Number of threads for counting.
+    size_t num_threads_ = 1;
+
+    // Count words and co-occurrences in a single pass?
+    bool single_pass_ = false;
+
+    // Memory limit for co-occurrence counts in megabytes (0 means no limit).
+    // Counts beyond the limit are spilled to sorted run files.
+    size_t memory_limit_ = 0;
+
+    // Memory for approximate co-occurrence counts in megabytes (0 means exact
+    // counts): half for count-min sketches, a quarter for buffering exact
+    // counts, and a quarter for candidates of the heaviest pairs.
+    size_t sketch_memory_ = 0;
+
+    // Threshold for subsampling frequent words (0 means no subsampling), the
+    // seed for the random choices, and the probability of keeping each word
+    // (empty if not subsampling).
+    double subsample_threshold_ = 0.0;
+    size_t subsample_seed_ = 1;
+    vector<double> keep_probability_;
+
+    // Count co-occurrences by sort and reduce instead of in hash tables?
+    bool sort_counts_ = false;
+
+    // Number of most frequent words whose pairs with bag or list contexts
+    // are counted in a dense block (0 means none).
+    size_t head_size_ = 0;
+
+    // Window word IDs from head_begin_ on are in the head block
+    // (string::npos if there is none), which has num_head_words_ words and
+    // num_head_slots_ context slots from head_slot_offset_ on, skipping the
+    // slot of the center (string::npos for bags).
+    Word head_begin_ = string::npos;
+    size_t num_head_words_ = 0;
+    size_t num_head_slots_ = 0;
+    size_t head_slot_offset_ = 0;
+    size_t head_center_slot_ = string::npos;
+
+    // Cache the corpus as word IDs and slide windows over the cache?
+    bool cache_tokens_ = false;
+
+    // Additional window configurations counted in the same corpus pass,
+    // e.g., "5:list,11:baglist" (window size:context definition).
+    string configurations_;
 };
 
 #endif  // WORDREP_H
@@ -3,8 +3,12 @@
 // Check the correctness of the code in the source directory.
 
 #include <random>
+#include <sstream>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
+#include "../src/corpus.h"
+#include "../src/counts.h"
 #include "../src/sparsesvd.h"
 #include "../src/wordrep.h"
 
@@ -147,6 +151,389 @@ TEST_F(SparseMatrixWithEmptyColumns, CheckWritingAndLoading) {
     EXPECT_NEAR(1.5716, fabs(*(sparsesvd_solver_.singular_values() + 1)), tol_);
 }
 
+// Checks that the corpus reader reads lines (within a byte range) as getline.
+TEST(CorpusReader, CheckLines) {
+    string temp_file_path = tmpnam(nullptr);
+    ofstream temp_file(temp_file_path, ios::out);
+    temp_file << "a b" << endl << endl << "c" << endl << "d e";  // No newline
+    temp_file.close();
+
+    StringPiece line;
+    vector<string> lines;
+    CorpusReader reader(temp_file_path);
+    while (reader.NextLine(&line)) {
+	lines.push_back(string(line.data, line.size));
+    }
+    EXPECT_EQ(vector<string>({"a b", "", "c", "d e"}), lines);
+
+    lines.clear();
+    CorpusReader range_reader(temp_file_path, 5, 7);  // Lines starting in [5, 7)
+    while (range_reader.NextLine(&line)) {
+	lines.push_back(string(line.data, line.size));
+    }
+    EXPECT_EQ(vector<string>({"c"}), lines);
+}
+
+// Checks that a compressed corpus is streamed into the same lines as the
+// plain corpus, also for lines spanning blocks of the stream.
+TEST(CorpusReader, CheckCompressedLinesMatchPlain) {
+    string temp_file_path = tmpnam(nullptr);
+    ofstream temp_file(temp_file_path, ios::out);
+    for (size_t i = 0; i < 3000; ++i) {
+	temp_file << string(i * 7 % 2000, 'a' + i % 26) << endl;
+    }
+    temp_file << "last";  // No newline
+    temp_file.close();
+    string compressed_path = temp_file_path + ".gz";
+    ASSERT_EQ(0, system(("gzip -c " + temp_file_path + " > " +
+			 compressed_path).c_str()));
+
+    StringPiece line;
+    vector<string> lines;
+    vector<string> streamed_lines;
+    CorpusReader reader(temp_file_path);
+    while (reader.NextLine(&line)) {
+	lines.push_back(string(line.data, line.size));
+    }
+    CorpusReader streamed_reader(compressed_path);
+    while (streamed_reader.NextLine(&line)) {
+	streamed_lines.push_back(string(line.data, line.size));
+    }
+    EXPECT_EQ(3001, lines.size());
+    EXPECT_EQ(lines, streamed_lines);
+    EXPECT_EQ(reader.position(), streamed_reader.position());
+    remove(temp_file_path.c_str());
+    remove(compressed_path.c_str());
+}
+
+// Checks that a reader of standard input can be closed while no text comes.
+TEST(CorpusReader, CheckCloseWhileStandardInputWaits) {
+    int pipe_descriptors[2];
+    ASSERT_EQ(0, pipe(pipe_descriptors));
+    int stdin_descriptor = dup(STDIN_FILENO);
+    dup2(pipe_descriptors[0], STDIN_FILENO);
+    {
+	CorpusReader reader("-");  // The write end stays open and silent.
+    }
+    dup2(stdin_descriptor, STDIN_FILENO);
+    close(stdin_descriptor);
+    close(pipe_descriptors[0]);
+    close(pipe_descriptors[1]);
+}
+
+// Checks that lines read in pieces of bounded size give the tokens of the
+// lines, with a token longer than the bound in a piece of its own, and that
+// a compressed corpus gives the same pieces.
+TEST(CorpusReader, CheckPiecesMatchLines) {
+    string temp_file_path = tmpnam(nullptr);
+    ofstream temp_file(temp_file_path, ios::out);
+    temp_file << "a bb ccc dddd eeeee ffffff" << endl << endl;
+    temp_file << "0123456789abcdef x  y " << endl;
+    for (size_t i = 0; i < 20000; ++i) { temp_file << "t" << i % 97 << " "; }
+    temp_file << endl << "last";  // No newline
+    temp_file.close();
+    string compressed_path = temp_file_path + ".gz";
+    ASSERT_EQ(0, system(("gzip -c " + temp_file_path + " > " +
+			 compressed_path).c_str()));
+
+    StringManipulator string_manipulator;
+    StringPiece line;
+    vector<StringPiece> tokens;
+    vector<string> line_tokens;
+    CorpusReader line_reader(temp_file_path);
+    while (line_reader.NextLine(&line)) {
+	string_manipulator.Split(line, ' ', &tokens);
+	for (const StringPiece &token : tokens) {
+	    line_tokens.push_back(string(token.data, token.size));
+	}
+	line_tokens.push_back("\n");
+    }
+    for (const string &file_path : {temp_file_path, compressed_path}) {
+	vector<string> piece_tokens;
+	CorpusReader reader(file_path);
+	bool line_end;
+	while (reader.NextPiece(10, &line, &line_end)) {
+	    string_manipulator.Split(line, ' ', &tokens);
+	    EXPECT_TRUE(line.size <= 10 || tokens.size() == 1);
+	    for (const StringPiece &token : tokens) {
+		piece_tokens.push_back(string(token.data, token.size));
+	    }
+	    if (line_end) { piece_tokens.push_back("\n"); }
+	}
+	EXPECT_EQ(line_tokens, piece_tokens);
+	EXPECT_EQ(line_reader.position(), reader.position());
+    }
+    remove(temp_file_path.c_str());
+    remove(compressed_path.c_str());
+}
+
+// Checks that progress over a file is reported as the percentage of bytes
+// read, and that the line ends with the message after the last report.
+TEST(ProgressReporter, CheckPercentageOfBytes) {
+    string temp_file_path = tmpnam(nullptr);
+    ofstream temp_file(temp_file_path, ios::out);
+    temp_file << "a b c" << endl << "d" << endl << "e f g h i j k" << endl;
+    temp_file.close();  // Lines end at bytes 6, 8, 22 of 22
+
+    ostringstream progress_stream;
+    streambuf *cerr_buffer = cerr.rdbuf(progress_stream.rdbuf());
+    ProgressReporter progress(22, 0.25);
+    progress.StartLine("Reading");
+    StringPiece line;
+    CorpusReader reader(temp_file_path);
+    while (reader.NextLine(&line)) { progress.Update(reader.position(), 1); }
+    progress.EndLine(" 3 lines");
+    cerr.rdbuf(cerr_buffer);
+
+    string output = progress_stream.str();
+    EXPECT_NE(string::npos, output.find("\rReading 27% ("));
+    EXPECT_EQ(string::npos, output.find("\rReading 36% ("));  // Not due
+    string last_line = output.substr(output.rfind('\r') + 1);
+    EXPECT_EQ(0, last_line.find("Reading 100% ("));
+    EXPECT_EQ(last_line.size() - 10, last_line.rfind(") 3 lines\n"));
+    remove(temp_file_path.c_str());
+}
+
+// Checks that progress of several threads sharing a reporter adds up to the
+// whole work.
+TEST(ProgressReporter, CheckSharedProgress) {
+    ostringstream progress_stream;
+    streambuf *cerr_buffer = cerr.rdbuf(progress_stream.rdbuf());
+    ProgressReporter shared(100, 0.25);
+    shared.StartLine("Sharing");
+    vector<thread> workers;
+    for (size_t thread_num = 0; thread_num < 4; ++thread_num) {
+	workers.push_back(thread([&shared]() {
+	    ProgressReporter progress(25, 0.1);
+	    progress.ShareWith(&shared);
+	    for (size_t i = 1; i <= 25; ++i) { progress.Update(i, i); }
+	    progress.Report(25, 25);
+	}));
+    }
+    for (thread &worker : workers) { worker.join(); }
+    shared.EndLine("");
+    cerr.rdbuf(cerr_buffer);
+
+    string output = progress_stream.str();
+    EXPECT_NE(string::npos, output.find("\rSharing 25% ("));
+    string last_line = output.substr(output.rfind('\r') + 1);
+    EXPECT_EQ(0, last_line.find("Sharing 100% ("));
+}
+
+// Checks that splitting into pieces matches splitting into strings, also for
+// lines longer than a vector block with runs of delimiters across blocks.
+TEST(StringManipulator, CheckSplitPieces) {
+    StringManipulator string_manipulator;
+    vector<string> lines = {"", "   ", "a", " a  bb ccc ", "the quick brown "
+			    "fox jumps  over          the lazy dog",
+			    "0123456789abcdefghij  x                  y"};
+    vector<string> tokens;
+    vector<StringPiece> pieces;
+    for (const string &line : lines) {
+	string_manipulator.Split(line, " ", &tokens);
+	string_manipulator.Split(StringPiece{line.data(), line.size()}, ' ',
+				 &pieces);
+	vector<string> piece_strings;
+	for (const StringPiece &piece : pieces) {
+	    piece_strings.push_back(string(piece.data, piece.size));
+	}
+	EXPECT_EQ(tokens, piece_strings);
+    }
+}
+
+// Checks that co-occurrence counts survive 32-bit overflow and convert to a
+// sparse matrix with rows sorted in each column.
+TEST(CooccurrenceCounts, CheckOverflowAndSparseMatrix) {
+    CooccurrenceCounts counts;
+    for (size_t i = 0; i < 3000; ++i) { counts.Add(i % 3, i % 1000); }
+    counts.Add(1, 7, UINT32_MAX - 1);
+    counts.Add(1, 7, 5);
+    EXPECT_EQ(3000, counts.size());
+    EXPECT_EQ((uint64_t) UINT32_MAX + 5, counts.Get(1, 7));
+    EXPECT_EQ(0, counts.Get(3, 7));
+    EXPECT_EQ(8192 * 12, counts.memory_usage());  // Packed slots
+
+    SMat sparse_matrix = counts.ToSparseMatrix(1000, 4, 2);
+    EXPECT_EQ(3000, sparse_matrix->vals);
+    EXPECT_EQ(0, counts.size());
+    for (long col = 0; col < 3; ++col) {
+	EXPECT_EQ(1000 * col, sparse_matrix->pointr[col]);
+	for (long i = sparse_matrix->pointr[col] + 1;
+	     i < sparse_matrix->pointr[col + 1]; ++i) {
+	    EXPECT_LT(sparse_matrix->rowind[i - 1], sparse_matrix->rowind[i]);
+	}
+    }
+    EXPECT_EQ(3000, sparse_matrix->pointr[3]);  // Empty last column
+    EXPECT_EQ(3000, sparse_matrix->pointr[4]);
+    EXPECT_EQ((double) UINT32_MAX + 5, sparse_matrix->value[1000 + 7]);
+    svdFreeSMat(sparse_matrix);
+}
+
+// Checks that counting by sort and reduce (with a buffer small enough to
+// make many blocks) gives the counts of the hash table.
+TEST(CooccurrenceCounts, CheckSortAndReduceMatchesHashTable) {
+    CooccurrenceCounts hashed_counts;
+    CooccurrenceCounts sorted_counts;
+    sorted_counts.UseSortAndReduce(100);
+    for (size_t i = 0; i < 5000; ++i) {
+	size_t context = (i * 7919) % 70000 % 13;  // Large keys, repeated
+	size_t word = (i * 104729) % 90001 % 200 + (1 << 20);
+	uint64_t count = (i % 11 == 0) ? i : 1;
+	hashed_counts.Add(context, word, count);
+	sorted_counts.Add(context, word, count);
+    }
+    EXPECT_EQ(hashed_counts.Get(3, (1 << 20) + 5),
+	      sorted_counts.Get(3, (1 << 20) + 5));
+
+    SMat hashed_matrix = hashed_counts.ToSparseMatrix((1 << 20) + 200, 14, 2);
+    SMat sorted_matrix = sorted_counts.ToSparseMatrix((1 << 20) + 200, 14, 2);
+    EXPECT_EQ(0, sorted_counts.size());
+    ASSERT_EQ(hashed_matrix->vals, sorted_matrix->vals);
+    for (long col = 0; col <= 14; ++col) {
+	EXPECT_EQ(hashed_matrix->pointr[col], sorted_matrix->pointr[col]);
+    }
+    for (long i = 0; i < hashed_matrix->vals; ++i) {
+	EXPECT_EQ(hashed_matrix->rowind[i], sorted_matrix->rowind[i]);
+	EXPECT_EQ(hashed_matrix->value[i], sorted_matrix->value[i]);
+    }
+    svdFreeSMat(hashed_matrix);
+    svdFreeSMat(sorted_matrix);
+}
+
+// Checks that the HyperLogLog estimate is close to the number of distinct
+// keys, and that a presized table counts as one that grows.
+TEST(CooccurrenceCounts, CheckDistinctEstimateAndPresizing) {
+    HyperLogLog counter;
+    EXPECT_EQ(0.0, counter.Estimate());
+    for (size_t i = 0; i < 300000; ++i) { counter.Add(i % 100000); }
+    EXPECT_NEAR(100000.0, counter.Estimate(), 2000.0);
+
+    CooccurrenceCounts grown_counts;
+    CooccurrenceCounts presized_counts;
+    presized_counts.Reserve(3000);
+    size_t memory_usage = presized_counts.memory_usage();
+    for (size_t i = 0; i < 9000; ++i) {
+	grown_counts.Add(i % 3, i % 1000);
+	presized_counts.Add(i % 3, i % 1000);
+    }
+    EXPECT_EQ(memory_usage, presized_counts.memory_usage());  // No growth
+    EXPECT_EQ(3000, presized_counts.size());
+    EXPECT_EQ(grown_counts.Get(2, 998), presized_counts.Get(2, 998));
+    EXPECT_EQ(3, presized_counts.Get(2, 998));
+}
+
+// Checks that merging sorted runs (one of them with renumbered contexts) sums
+// the counts of a pair across runs, and gives the marginals.
+TEST(CooccurrenceCounts, CheckMergeRuns) {
+    CooccurrenceCounts counts;
+    string run_path1 = tmpnam(nullptr);
+    string run_path2 = tmpnam(nullptr);
+    counts.Add(0, 1, 3);
+    counts.Add(2, 0, 1);
+    counts.WriteRun(run_path1, 1);
+    EXPECT_EQ(0, counts.size());
+
+    // Renumber contexts 0 <-> 2 in the second run.
+    counts.Add(0, 0, 2);
+    counts.Add(1, 1, 4);
+    counts.WriteRun(run_path2, 1);
+    counts.AddRun(run_path2, {2, 1, 0}, {});
+    counts.WriteRun(run_path2, 1);
+
+    string matrix_path = tmpnam(nullptr);
+    vector<double> row_sum;
+    vector<double> column_sum;
+    CooccurrenceCounts::MergeRuns({run_path1, run_path2}, 2, 4, matrix_path,
+				  &row_sum, &column_sum);
+    SparseSVDSolver sparsesvd_solver;
+    SMat sparse_matrix = sparsesvd_solver.ReadSparseMatrixFromFile(
+	matrix_path);
+    EXPECT_EQ(3, sparse_matrix->vals);
+    EXPECT_EQ(1, sparse_matrix->rowind[0]);  // Column 0: (1, 3)
+    EXPECT_EQ(3.0, sparse_matrix->value[0]);
+    EXPECT_EQ(1, sparse_matrix->rowind[1]);  // Column 1: (1, 4)
+    EXPECT_EQ(4.0, sparse_matrix->value[1]);
+    EXPECT_EQ(0, sparse_matrix->rowind[2]);  // Column 2: (0, 1 + 2)
+    EXPECT_EQ(3.0, sparse_matrix->value[2]);
+    EXPECT_EQ(3, sparse_matrix->pointr[3]);  // Column 3: empty
+    EXPECT_EQ(3, sparse_matrix->pointr[4]);
+    EXPECT_EQ(vector<double>({3.0, 7.0}), row_sum);
+    EXPECT_EQ(vector<double>({3.0, 4.0, 3.0, 0.0}), column_sum);
+    svdFreeSMat(sparse_matrix);
+    remove(run_path1.c_str());
+    remove(run_path2.c_str());
+    remove(matrix_path.c_str());
+}
+
+// Checks that counts with more than six significant digits are written and
+// read back exactly, by a merge of runs and by a rewrite of the matrix.
+TEST(CooccurrenceCounts, CheckLargeCountsAreWrittenExactly) {
+    CooccurrenceCounts counts;
+    string run_path = tmpnam(nullptr);
+    counts.Add(0, 1, 123456789);
+    counts.WriteRun(run_path, 1);
+
+    string matrix_path = tmpnam(nullptr);
+    vector<double> row_sum;
+    vector<double> column_sum;
+    CooccurrenceCounts::MergeRuns({run_path}, 2, 1, matrix_path, &row_sum,
+				  &column_sum);
+    SparseSVDSolver sparsesvd_solver;
+    SMat sparse_matrix = sparsesvd_solver.ReadSparseMatrixFromFile(
+	matrix_path);
+    EXPECT_EQ(123456789.0, sparse_matrix->value[0]);
+
+    sparsesvd_solver.WriteSparseMatrix(sparse_matrix, matrix_path, &row_sum,
+				       &column_sum);
+    svdFreeSMat(sparse_matrix);
+    sparse_matrix = sparsesvd_solver.ReadSparseMatrixFromFile(matrix_path);
+    EXPECT_EQ(123456789.0, sparse_matrix->value[0]);
+    svdFreeSMat(sparse_matrix);
+    remove(run_path.c_str());
+    remove(matrix_path.c_str());
+}
+
+// Checks that sketch estimates never fall below the counts and that heavy
+// pairs stay candidates.
+TEST(CooccurrenceSketch, CheckEstimatesAndCandidates) {
+    CooccurrenceSketch sketch;
+    sketch.Initialize(1 << 16, 10);
+    EXPECT_TRUE(sketch.initialized());
+    for (size_t i = 0; i < 20000; ++i) {  // Each pair 4 times
+	sketch.Add(i % 5000, i % 5000 % 7, 1);
+    }
+    for (size_t heavy = 0; heavy < 10; ++heavy) {
+	sketch.Add(9000 + heavy, heavy, 100);
+    }
+    EXPECT_EQ(21000, sketch.total());
+    for (size_t i = 0; i < 5000; ++i) {
+	EXPECT_LE(4, sketch.Estimate(i, i % 7));
+    }
+    size_t num_heavy_candidates = 0;
+    sketch.ForEachCandidate([&](size_t context, size_t word) {
+	    if (context >= 9000) {
+		EXPECT_EQ(context - 9000, word);
+		EXPECT_LE(100, sketch.Estimate(context, word));
+		++num_heavy_candidates;
+	    }
+	});
+    EXPECT_EQ(10, num_heavy_candidates);
+}
+
+// Checks that pruning candidates tied at the threshold keeps as many as
+// allowed.
+TEST(CooccurrenceSketch, CheckTiedCandidatesAreKept) {
+    CooccurrenceSketch sketch;
+    sketch.Initialize(1 << 16, 10);
+    for (size_t i = 0; i < 100; ++i) { sketch.Add(i, 0, 1); }
+    size_t num_candidates = 0;
+    sketch.ForEachCandidate([&](size_t context, size_t word) {
+	    ++num_candidates;
+	});
+    EXPECT_LE(10, num_candidates);
+    EXPECT_GE(20, num_candidates);
+}
+
 // Test class that provides a simple corpus for inducing word vectors.
 class WordRepSimpleExample : public testing::Test {
 protected:
@@ -161,6 +548,13 @@ protected:
 
     virtual void TearDown() { }
 
+    // Returns the content of a file as a string.
+    string FileContent(const string &file_path) {
+	ifstream file(file_path, ios::in);
+	return string((istreambuf_iterator<char>(file)),
+		      istreambuf_iterator<char>());
+    }
+
     string temp_file_path_;
     string temp_output_directory_;
     StringManipulator string_manipulator_;
@@ -399,6 +793,694 @@ TEST_F(WordRepSimpleExample, CheckCountsCutoff1ListSize3SentencePerLine) {
     }
 }
 
+// Checks that counting with multiple threads gives the same files.
+TEST_F(WordRepSimpleExample, CheckThreadsMatchSingleThread) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    for (bool sentence_per_line : {false, true}) {
+	WordRep wordrep1(temp_output_directory_);
+	WordRep wordrep2(temp_output_directory2);
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->ResetOutputDirectory();
+	    wordrep->set_rare_cutoff(0);
+	    wordrep->set_window_size(3);
+	    wordrep->set_context_definition("baglist");
+	    wordrep->set_sentence_per_line(sentence_per_line);
+	    wordrep->set_verbose(false);
+	}
+	wordrep2.set_num_threads(3);
+	wordrep1.ExtractStatistics(temp_file_path_);
+	wordrep2.ExtractStatistics(temp_file_path_);
+
+	for (const auto &paths :
+		 {make_pair(wordrep1.CountWordContextPath(),
+			    wordrep2.CountWordContextPath()),
+		  make_pair(wordrep1.CountWordPath(), wordrep2.CountWordPath()),
+		  make_pair(wordrep1.CountContextPath(),
+			    wordrep2.CountContextPath())}) {
+	    EXPECT_EQ(FileContent(paths.first), FileContent(paths.second));
+	}
+
+	wordrep1.LoadContextDictionary();
+	wordrep2.LoadContextDictionary();
+	for (Context context = 0; context < 9; ++context) {
+	    EXPECT_EQ(wordrep1.context_num2str(context),
+		      wordrep2.context_num2str(context));
+	}
+    }
+}
+
+// Checks that counting words and co-occurrences in a single pass gives the
+// same files as counting them in two passes.
+TEST_F(WordRepSimpleExample, CheckSinglePassMatchesTwoPasses) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    for (string context_definition : {"list", "skipgram"}) {
+	WordRep wordrep1(temp_output_directory_);
+	WordRep wordrep2(temp_output_directory2);
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->ResetOutputDirectory();
+	    wordrep->set_rare_cutoff(1);
+	    wordrep->set_window_size(3);
+	    wordrep->set_context_definition(context_definition);
+	    wordrep->set_verbose(false);
+	}
+	wordrep2.set_single_pass(true);
+	wordrep1.ExtractStatistics(temp_file_path_);
+	wordrep2.ExtractStatistics(temp_file_path_);
+
+	EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+		  FileContent(wordrep2.CountWordContextPath()));
+	EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+		  FileContent(wordrep2.CountWordPath()));
+	EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+		  FileContent(wordrep2.CountContextPath()));
+    }
+}
+
+// Checks that counting under a memory limit small enough to spill several
+// runs per thread (renumbered when shards merge, and folded in a single pass)
+// gives the same files as counting without a limit.
+TEST_F(WordRepSimpleExample, CheckSpilledCountsMatchUnlimited) {
+    string corpus_path = tmpnam(nullptr);
+    ofstream corpus_file(corpus_path, ios::out);
+    uint64_t state = 1;  // Pseudo-random words, so that pairs are many
+    for (size_t i = 0; i < 90000; ++i) {
+	state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+	corpus_file << "w" << (state >> 33) % 500
+		    << ((i % 20 == 19) ? "\n" : " ");
+    }
+    corpus_file.close();
+    for (bool single_pass : {false, true}) {
+	vector<string> output_directories = {tmpnam(nullptr), tmpnam(nullptr)};
+	for (size_t memory_limit : {0, 1}) {
+	    WordRep wordrep(output_directories[memory_limit]);
+	    wordrep.set_rare_cutoff(2);
+	    wordrep.set_window_size(5);
+	    wordrep.set_context_definition("bag");
+	    wordrep.set_num_threads(3);
+	    wordrep.set_single_pass(single_pass);
+	    wordrep.set_memory_limit(memory_limit);
+	    wordrep.set_verbose(false);
+	    wordrep.ExtractStatistics(corpus_path);
+	}
+	EXPECT_NE(string::npos, FileContent(output_directories[1] +
+					    "/log.1").find("spilled runs"));
+	WordRep wordrep(output_directories[0]);
+	wordrep.set_rare_cutoff(2);
+	wordrep.set_window_size(5);
+	wordrep.set_context_definition("bag");
+	for (const string &path : {wordrep.CountWordContextPath(),
+		    wordrep.CountWordPath(), wordrep.CountContextPath()}) {
+	    string file_name = path.substr(output_directories[0].size());
+	    EXPECT_EQ(FileContent(output_directories[0] + file_name),
+		      FileContent(output_directories[1] + file_name));
+	}
+    }
+    remove(corpus_path.c_str());
+}
+
+// Checks that sliding windows over cached word IDs (also for different window
+// settings than the ones the cache was written with) matches reading text.
+TEST_F(WordRepSimpleExample, CheckCachedTokensMatchText) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    wordrep2.set_cache_tokens(true);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(1);
+	wordrep->set_verbose(false);
+    }
+    for (bool sentence_per_line : {false, true}) {
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->set_sentence_per_line(sentence_per_line);
+	    wordrep->set_window_size((sentence_per_line) ? 2 : 3);
+	    wordrep->set_context_definition((sentence_per_line) ?
+					    "bag" : "list");
+	    wordrep->ExtractStatistics(temp_file_path_);
+	}
+	EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+		  FileContent(wordrep2.CountWordContextPath()));
+	EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+		  FileContent(wordrep2.CountContextPath()));
+    }
+}
+
+// Checks that in whole-text mode a line longer than a sentence (and than a
+// piece of text) is counted as the same text split into short lines, and
+// that with a sentence per line its pairs are skipped alike from text and
+// from cached word IDs.
+TEST_F(WordRepSimpleExample, CheckLongLinesAreCountedInWholeText) {
+    string long_line_path = tmpnam(nullptr);
+    string short_lines_path = tmpnam(nullptr);
+    string last_line_path = tmpnam(nullptr);
+    ofstream long_line_file(long_line_path, ios::out);
+    ofstream short_lines_file(short_lines_path, ios::out);
+    ofstream last_line_file(last_line_path, ios::out);
+    for (size_t i = 0; i < 300000; ++i) {
+	long_line_file << "w" << i * i % 101 << " ";
+	short_lines_file << "w" << i * i % 101
+			 << ((i % 10 == 9) ? "\n" : " ");
+    }
+    long_line_file << endl << "a b c" << endl;
+    short_lines_file << "a b c" << endl;
+    last_line_file << "a b c" << endl;
+    long_line_file.close();
+    short_lines_file.close();
+    last_line_file.close();
+
+    // Returns the co-occurrence counts of the corpus.
+    auto count = [&](const string &corpus_path, bool sentence_per_line,
+		     bool cache_tokens) {
+	WordRep wordrep(tmpnam(nullptr));
+	wordrep.set_rare_cutoff(0);
+	wordrep.set_window_size(3);
+	wordrep.set_context_definition("list");
+	wordrep.set_sentence_per_line(sentence_per_line);
+	wordrep.set_cache_tokens(cache_tokens);
+	wordrep.set_verbose(false);
+	wordrep.ExtractStatistics(corpus_path);
+	return FileContent(wordrep.CountWordContextPath());
+    };
+    string whole_text_counts = count(short_lines_path, false, false);
+    EXPECT_EQ(whole_text_counts, count(long_line_path, false, false));
+    EXPECT_EQ(whole_text_counts, count(long_line_path, false, true));
+    // The words of the skipped line stay in the vocabulary (the header).
+    string sentence_counts = count(long_line_path, true, false);
+    EXPECT_EQ(sentence_counts, count(long_line_path, true, true));
+    string last_line_counts = count(last_line_path, true, false);
+    EXPECT_EQ(last_line_counts.substr(last_line_counts.find('\n')),
+	      sentence_counts.substr(sentence_counts.find('\n')));
+    remove(long_line_path.c_str());
+    remove(short_lines_path.c_str());
+    remove(last_line_path.c_str());
+}
+
+// Checks that the words of a line too long for a sentence count in the
+// vocabulary with or without a sentence per line (and in a single pass), so
+// that runs in both modes share the word files of an output directory.
+TEST_F(WordRepSimpleExample, CheckLongLinesCountInVocabularyOfBothModes) {
+    string corpus_path = tmpnam(nullptr);
+    ofstream corpus_file(corpus_path, ios::out);
+    for (size_t i = 0; i < 2000; ++i) { corpus_file << "long" << i % 10 << " "; }
+    corpus_file << endl << "a b c" << endl << "a b c" << endl;
+    corpus_file.close();
+
+    // Returns the word types and the co-occurrence counts of the corpus.
+    auto count = [&](const string &output_directory, bool sentence_per_line,
+		     bool single_pass) {
+	WordRep wordrep(output_directory);
+	wordrep.set_rare_cutoff(5);
+	wordrep.set_window_size(3);
+	wordrep.set_context_definition("list");
+	wordrep.set_sentence_per_line(sentence_per_line);
+	wordrep.set_single_pass(single_pass);
+	wordrep.set_verbose(false);
+	wordrep.ExtractStatistics(corpus_path);
+	return make_pair(FileContent(output_directory + "/sorted_word_types"),
+			 FileContent(wordrep.CountWordContextPath()));
+    };
+    string shared_output_directory = tmpnam(nullptr);
+    auto sentence_counts = count(shared_output_directory, true, false);
+    auto whole_text_counts = count(shared_output_directory, false, false);
+    EXPECT_EQ(whole_text_counts, count(tmpnam(nullptr), false, false));
+    EXPECT_EQ(sentence_counts, count(tmpnam(nullptr), true, true));
+    EXPECT_EQ(sentence_counts.first, whole_text_counts.first);
+    EXPECT_NE(sentence_counts.second, whole_text_counts.second);
+    remove(corpus_path.c_str());
+}
+
+// Checks that counting several configurations in one pass matches counting
+// them separately.
+TEST_F(WordRepSimpleExample, CheckConfigurationsMatchSeparateRuns) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(1);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+    }
+    wordrep2.set_configurations("2:bag,3:skipgram");
+    wordrep2.ExtractStatistics(temp_file_path_);
+    for (const auto &configuration : vector<pair<size_t, string> >(
+	     {{3, "list"}, {2, "bag"}, {3, "skipgram"}})) {
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->set_window_size(configuration.first);
+	    wordrep->set_context_definition(configuration.second);
+	}
+	wordrep1.ExtractStatistics(temp_file_path_);
+	EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+		  FileContent(wordrep2.CountWordContextPath()));
+	EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+		  FileContent(wordrep2.CountWordPath()));
+	EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+		  FileContent(wordrep2.CountContextPath()));
+    }
+}
+
+// Checks that counts derived from list counts of a larger window match
+// counting them from the corpus.
+TEST_F(WordRepSimpleExample, CheckDerivedCountsMatchCorpusCounts) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    for (bool sentence_per_line : {false, true}) {
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->ResetOutputDirectory();
+	    wordrep->set_rare_cutoff(0);
+	    wordrep->set_sentence_per_line(sentence_per_line);
+	    wordrep->set_verbose(false);
+	}
+	wordrep2.set_window_size(5);
+	wordrep2.set_context_definition("list");
+	wordrep2.ExtractStatistics(temp_file_path_);
+	for (const auto &configuration : vector<pair<size_t, string> >(
+		 {{3, "list"}, {3, "bag"}, {5, "bag"}, {4, "baglist"},
+		  {2, "bag"}})) {
+	    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+		wordrep->set_window_size(configuration.first);
+		wordrep->set_context_definition(configuration.second);
+	    }
+	    wordrep1.ExtractStatistics(temp_file_path_);
+	    wordrep2.DeriveCounts(5);
+	    EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+		      FileContent(wordrep2.CountWordContextPath()));
+	    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+		      FileContent(wordrep2.CountWordPath()));
+	    EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+		      FileContent(wordrep2.CountContextPath()));
+	    string count_context = FileContent(wordrep1.CountContextPath());
+	    wordrep1.LoadContextDictionary();
+	    wordrep2.LoadContextDictionary();
+	    size_t num_contexts = count(count_context.begin(),
+					count_context.end(), '\n');
+	    for (Context context = 0; context < num_contexts; ++context) {
+		EXPECT_EQ(wordrep1.context_num2str(context),
+			  wordrep2.context_num2str(context));
+	    }
+	}
+    }
+}
+
+// Checks that counts re-bucketed from a smaller rare cutoff match counting
+// them from the corpus.
+TEST_F(WordRepSimpleExample, CheckRebucketedCountsMatchCorpusCounts) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    for (string context_definition : {"baglist", "skipgram"}) {
+	for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	    wordrep->ResetOutputDirectory();
+	    wordrep->set_rare_cutoff(0);
+	    wordrep->set_window_size(3);
+	    wordrep->set_context_definition(context_definition);
+	    wordrep->set_verbose(false);
+	}
+	wordrep2.ExtractStatistics(temp_file_path_);
+	for (size_t rare_cutoff : {1, 3}) {
+	    wordrep1.set_rare_cutoff(rare_cutoff);
+	    wordrep2.set_rare_cutoff(rare_cutoff);
+	    wordrep1.ExtractStatistics(temp_file_path_);
+	    wordrep2.RebucketCounts(0);
+	    EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+		      FileContent(wordrep2.CountWordContextPath()));
+	    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+		      FileContent(wordrep2.CountWordPath()));
+	    EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+		      FileContent(wordrep2.CountContextPath()));
+	}
+    }
+}
+
+// Checks that approximate counts with ample memory match exact counts.
+TEST_F(WordRepSimpleExample, CheckSketchWithAmpleMemoryMatchesExact) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    wordrep2.set_sketch_memory(1);
+    wordrep2.set_num_threads(2);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(1);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+	wordrep->ExtractStatistics(temp_file_path_);
+    }
+    EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+	      FileContent(wordrep2.CountWordContextPath()));
+    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+	      FileContent(wordrep2.CountWordPath()));
+    EXPECT_EQ(FileContent(wordrep1.CountContextPath()),
+	      FileContent(wordrep2.CountContextPath()));
+}
+
+// Checks that hashed contexts are numbered by their buckets and keep the
+// word counts and the total count.
+TEST_F(WordRepSimpleExample, CheckHashedContextsAreBuckets) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    wordrep2.set_num_context_hashed(3);
+    wordrep2.set_num_threads(2);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(0);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+	wordrep->ExtractStatistics(temp_file_path_);
+    }
+    wordrep2.LoadContextDictionary();
+    for (Context bucket = 0; bucket < 3; ++bucket) {
+	EXPECT_EQ(to_string(bucket), wordrep2.context_num2str(bucket));
+    }
+    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+	      FileContent(wordrep2.CountWordPath()));
+
+    SparseSVDSolver sparsesvd_solver;
+    SMat matrix1 = sparsesvd_solver.ReadSparseMatrixFromFile(
+	wordrep1.CountWordContextPath());
+    SMat matrix2 = sparsesvd_solver.ReadSparseMatrixFromFile(
+	wordrep2.CountWordContextPath());
+    EXPECT_EQ(3, matrix2->cols);
+    double total1 = 0.0;
+    double total2 = 0.0;
+    for (long i = 0; i < matrix1->vals; ++i) { total1 += matrix1->value[i]; }
+    for (long i = 0; i < matrix2->vals; ++i) { total2 += matrix2->value[i]; }
+    EXPECT_EQ(total1, total2);
+    svdFreeSMat(matrix1);
+    svdFreeSMat(matrix2);
+}
+
+// Checks that appending files one at a time gives the counts of counting
+// them together, also when a word becomes frequent only with the second file.
+TEST_F(WordRepSimpleExample, CheckAppendedCountsMatchCorpusCounts) {
+    string corpus_directory = tmpnam(nullptr);
+    ASSERT_EQ(0, system(("mkdir -p " + corpus_directory).c_str()));
+    ofstream file1(corpus_directory + "/1", ios::out);
+    file1 << "a b c" << endl << "a b d" << endl;
+    file1.close();
+    string later_path = tmpnam(nullptr);  // Arrives later
+    ofstream file2(later_path, ios::out);
+    file2 << "a b e" << endl << "c e a" << endl;
+    file2.close();
+
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(1);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+    }
+    wordrep2.AppendCorpus(corpus_directory);
+    ASSERT_EQ(0, system(("mv " + later_path + " " + corpus_directory +
+			 "/2").c_str()));
+    wordrep2.AppendCorpus(corpus_directory);
+    wordrep2.AppendCorpus(corpus_directory);  // Nothing new
+    wordrep1.ExtractStatistics(corpus_directory);
+
+    // Compare (word, context, count) triples.
+    vector<vector<string> > triples(2);
+    for (size_t k = 0; k < 2; ++k) {
+	WordRep *wordrep = (k == 0) ? &wordrep1 : &wordrep2;
+	wordrep->LoadWordDictionary();
+	wordrep->LoadContextDictionary();
+	SparseSVDSolver sparsesvd_solver;
+	SMat matrix = sparsesvd_solver.ReadSparseMatrixFromFile(
+	    wordrep->CountWordContextPath());
+	for (long col = 0; col < matrix->cols; ++col) {
+	    for (long i = matrix->pointr[col]; i < matrix->pointr[col + 1];
+		 ++i) {
+		triples[k].push_back(
+		    wordrep->word_num2str(matrix->rowind[i]) + " " +
+		    wordrep->context_num2str(col) + " " +
+		    to_string(matrix->value[i]));
+	    }
+	}
+	svdFreeSMat(matrix);
+	sort(triples[k].begin(), triples[k].end());
+    }
+    EXPECT_EQ(triples[0], triples[1]);
+    EXPECT_NE(triples[0].end(), find(triples[0].begin(), triples[0].end(),
+				     "e w(-1)=b 1.000000"));
+    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+	      FileContent(wordrep2.CountWordPath()));
+}
+
+// Checks that appending for two configurations in one directory gives the
+// counts of each, although the second append for the first configuration
+// renumbers the words that the counts of the second were made with.
+TEST_F(WordRepSimpleExample, CheckAppendedConfigurationsMatchCorpusCounts) {
+    string corpus_directory = tmpnam(nullptr);
+    ASSERT_EQ(0, system(("mkdir -p " + corpus_directory).c_str()));
+    ofstream file1(corpus_directory + "/1", ios::out);
+    file1 << "a b c" << endl << "a b d" << endl;
+    file1.close();
+    string later_path = tmpnam(nullptr);  // Arrives later, reorders words
+    ofstream file2(later_path, ios::out);
+    file2 << "e e e c" << endl << "c e" << endl;
+    file2.close();
+
+    vector<pair<size_t, string> > configurations = {{3, "list"}, {2, "bag"}};
+    auto configure = [&](size_t k, WordRep *wordrep) {
+	wordrep->set_window_size(configurations[k].first);
+	wordrep->set_context_definition(configurations[k].second);
+	wordrep->set_verbose(false);
+    };
+    auto triples = [](WordRep *wordrep) {
+	wordrep->LoadWordDictionary();
+	wordrep->LoadContextDictionary();
+	SparseSVDSolver sparsesvd_solver;
+	SMat matrix = sparsesvd_solver.ReadSparseMatrixFromFile(
+	    wordrep->CountWordContextPath());
+	vector<string> triples;
+	for (long col = 0; col < matrix->cols; ++col) {
+	    for (long i = matrix->pointr[col]; i < matrix->pointr[col + 1];
+		 ++i) {
+		triples.push_back(wordrep->word_num2str(matrix->rowind[i]) +
+				  " " + wordrep->context_num2str(col) + " " +
+				  to_string(matrix->value[i]));
+	    }
+	}
+	svdFreeSMat(matrix);
+	sort(triples.begin(), triples.end());
+	return triples;
+    };
+
+    WordRep reset_wordrep(temp_output_directory_);
+    reset_wordrep.ResetOutputDirectory();
+    for (size_t k = 0; k < 2; ++k) {
+	WordRep wordrep(temp_output_directory_);
+	configure(k, &wordrep);
+	wordrep.AppendCorpus(corpus_directory);
+    }
+    ASSERT_EQ(0, system(("mv " + later_path + " " + corpus_directory +
+			 "/2").c_str()));
+    for (size_t k = 0; k < 2; ++k) {
+	WordRep wordrep(temp_output_directory_);
+	configure(k, &wordrep);
+	wordrep.AppendCorpus(corpus_directory);
+	WordRep corpus_wordrep(tmpnam(nullptr));
+	corpus_wordrep.ResetOutputDirectory();
+	configure(k, &corpus_wordrep);
+	corpus_wordrep.ExtractStatistics(corpus_directory);
+	EXPECT_EQ(triples(&corpus_wordrep), triples(&wordrep));
+    }
+}
+
+// Checks that approximate counts are kept apart from exact counts in the
+// same output directory.
+TEST_F(WordRepSimpleExample, CheckSketchCountsAreKeptApart) {
+    WordRep wordrep(temp_output_directory_);
+    wordrep.ResetOutputDirectory();
+    wordrep.set_rare_cutoff(0);
+    wordrep.set_window_size(3);
+    wordrep.set_context_definition("list");
+    wordrep.set_verbose(false);
+    wordrep.set_sketch_memory(1);
+    wordrep.ExtractStatistics(temp_file_path_);
+    string sketch_path = wordrep.CountWordContextPath();
+    wordrep.set_sketch_memory(0);
+    EXPECT_NE(sketch_path, wordrep.CountWordContextPath());
+    wordrep.ExtractStatistics(temp_file_path_);
+
+    WordRep exact_wordrep(tmpnam(nullptr));
+    exact_wordrep.ResetOutputDirectory();
+    exact_wordrep.set_rare_cutoff(0);
+    exact_wordrep.set_window_size(3);
+    exact_wordrep.set_context_definition("list");
+    exact_wordrep.set_verbose(false);
+    exact_wordrep.ExtractStatistics(temp_file_path_);
+    EXPECT_EQ(FileContent(exact_wordrep.CountWordContextPath()),
+	      FileContent(wordrep.CountWordContextPath()));
+}
+
+// Checks that subsampling drops the same words with any number of threads,
+// and that a threshold of 1 drops none.
+TEST_F(WordRepSimpleExample, CheckSubsamplingIsDeterministic) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    string temp_output_directory3 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    WordRep wordrep3(temp_output_directory3);
+    wordrep1.set_subsample_threshold(0.1);
+    wordrep2.set_subsample_threshold(0.1);
+    wordrep2.set_num_threads(3);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2, &wordrep3}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(0);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+	wordrep->ExtractStatistics(temp_file_path_);
+    }
+    EXPECT_EQ(FileContent(wordrep1.CountWordContextPath()),
+	      FileContent(wordrep2.CountWordContextPath()));
+    EXPECT_EQ(FileContent(wordrep1.CountWordPath()),
+	      FileContent(wordrep2.CountWordPath()));
+
+    string unsubsampled_counts = FileContent(wordrep3.CountWordContextPath());
+    wordrep3.set_subsample_threshold(1.0);
+    wordrep3.ExtractStatistics(temp_file_path_);
+    EXPECT_EQ(unsubsampled_counts,
+	      FileContent(wordrep3.CountWordContextPath()));
+}
+
+// Checks that subsampling drops the same words with any number of threads,
+// from the text or from cached word IDs, in both whole-text and
+// sentence-per-line modes (also around a line too long for a sentence).
+TEST_F(WordRepSimpleExample, CheckCachedSubsamplingIsDeterministic) {
+    string corpus_directory = tmpnam(nullptr);
+    ASSERT_EQ(0, system(("mkdir -p " + corpus_directory).c_str()));
+    size_t state = 1;
+    for (size_t file_num = 0; file_num < 3; ++file_num) {
+	ofstream file(corpus_directory + "/" + to_string(file_num), ios::out);
+	for (size_t i = 0; i < 600; ++i) {
+	    state = (state * 1103515245 + 12345) % 2147483648;
+	    file << "w" << state % 20 << ((i % 6 == 5) ? "\n" : " ");
+	}
+	if (file_num == 1) {
+	    for (size_t i = 0; i < 1200; ++i) { file << "w" << i % 20 << " "; }
+	    file << endl;
+	}
+    }
+    for (bool sentence_per_line : {false, true}) {
+	vector<string> counts;
+	for (bool cache_tokens : {false, true}) {
+	    for (size_t num_threads : {1, 3}) {
+		WordRep wordrep(tmpnam(nullptr));
+		wordrep.ResetOutputDirectory();
+		wordrep.set_rare_cutoff(0);
+		wordrep.set_window_size(3);
+		wordrep.set_context_definition("list");
+		wordrep.set_sentence_per_line(sentence_per_line);
+		wordrep.set_subsample_threshold(0.01);
+		wordrep.set_cache_tokens(cache_tokens);
+		wordrep.set_num_threads(num_threads);
+		wordrep.set_verbose(false);
+		wordrep.ExtractStatistics(corpus_directory);
+		counts.push_back(FileContent(wordrep.CountWordContextPath()) +
+				 FileContent(wordrep.CountWordPath()));
+	    }
+	}
+	for (size_t i = 1; i < counts.size(); ++i) {
+	    EXPECT_EQ(counts[0], counts[i]);
+	}
+    }
+}
+
+// Checks that merging the counts of the files of a corpus, counted as
+// separate shards, gives the counts of the corpus.
+TEST_F(WordRepSimpleExample, CheckMergedShardsMatchCorpusCounts) {
+    string corpus_directory = tmpnam(nullptr);
+    ASSERT_EQ(0, system(("mkdir -p " + corpus_directory).c_str()));
+    ofstream file1(corpus_directory + "/1", ios::out);
+    file1 << "a b c" << endl << "a b d" << endl;
+    file1.close();
+    ofstream file2(corpus_directory + "/2", ios::out);
+    file2 << "a b e" << endl << "c e a" << endl;
+    file2.close();
+
+    string temp_output_directory2 = tmpnam(nullptr);
+    WordRep wordrep1(temp_output_directory_);
+    WordRep wordrep2(temp_output_directory2);
+    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+	wordrep->ResetOutputDirectory();
+	wordrep->set_rare_cutoff(1);
+	wordrep->set_window_size(3);
+	wordrep->set_context_definition("list");
+	wordrep->set_verbose(false);
+    }
+    wordrep1.ExtractStatistics(corpus_directory);
+
+    // Count the shards in the order of the files in the corpus.
+    wordrep2.ExtractWordCounts(corpus_directory);
+    FileManipulator file_manipulator;
+    vector<string> file_list;
+    file_manipulator.ListFiles(corpus_directory, &file_list);
+    vector<string> shard_directories;
+    for (const string &file_path : file_list) {
+	shard_directories.push_back(tmpnam(nullptr));
+	wordrep2.CountCorpusShard(file_path, shard_directories.back());
+    }
+    wordrep2.MergeCorpusShards(shard_directories);
+
+    for (const auto &paths :
+	     {make_pair(wordrep1.CountWordContextPath(),
+			wordrep2.CountWordContextPath()),
+	      make_pair(wordrep1.CountWordPath(), wordrep2.CountWordPath()),
+	      make_pair(wordrep1.CountContextPath(),
+			wordrep2.CountContextPath())}) {
+	EXPECT_EQ(FileContent(paths.first), FileContent(paths.second));
+    }
+    wordrep1.LoadContextDictionary();
+    wordrep2.LoadContextDictionary();
+    for (Context context = 0; context < 9; ++context) {
+	EXPECT_EQ(wordrep1.context_num2str(context),
+		  wordrep2.context_num2str(context));
+    }
+}
+
+// Checks that counting the pairs of frequent words in a dense head block
+// gives the same files as counting all pairs sparsely, also when the block
+// shares a memory budget with the spilled counts.
+TEST_F(WordRepSimpleExample, CheckHeadBlockMatchesSparseCounts) {
+    string temp_output_directory2 = tmpnam(nullptr);
+    for (size_t memory_limit : {0, 1}) {
+	for (const char *context_definition : {"bag", "list", "baglist"}) {
+	    WordRep wordrep1(temp_output_directory_);
+	    WordRep wordrep2(temp_output_directory2);
+	    wordrep2.set_head_size(3);
+	    wordrep2.set_num_threads(2);
+	    wordrep2.set_memory_limit(memory_limit);
+	    for (WordRep *wordrep : {&wordrep1, &wordrep2}) {
+		wordrep->ResetOutputDirectory();
+		wordrep->set_rare_cutoff(0);
+		wordrep->set_window_size(5);
+		wordrep->set_context_definition(context_definition);
+		wordrep->set_sentence_per_line(true);
+		wordrep->set_verbose(false);
+		wordrep->ExtractStatistics(temp_file_path_);
+	    }
+	    for (const auto &paths :
+		     {make_pair(wordrep1.CountWordContextPath(),
+				wordrep2.CountWordContextPath()),
+		      make_pair(wordrep1.CountWordPath(),
+				wordrep2.CountWordPath()),
+		      make_pair(wordrep1.CountContextPath(),
+				wordrep2.CountContextPath())}) {
+		EXPECT_EQ(FileContent(paths.first), FileContent(paths.second));
+	    }
+	}
+    }
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();